@@ -0,0 +1,89 @@
+/*
+ * Per message overhead of dispatch_queue consumer callbacks
+ *
+ * "std::function" builds std::function for every call the way get()/get_all_due() did before they took
+ * the callback by template, "template" passes the lambda directly, capture bigger than small buffer
+ * of std::function costs heap allocation per call on the first path
+ */
+
+#include <mks/dispatch_heap.h>
+#include <mks/dispatch_queue.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+
+namespace {
+
+constexpr int messages = 1000000;
+constexpr int runs = 7;
+
+struct big_capture {
+    long a[5] = {};
+};
+
+template <typename Backend, typename Consume>
+double run(Consume &&consume) {
+    double best = 0;
+    for(int r = 0; r != runs; ++r) {
+        dispatch_queue<long, Backend> queue;
+        queue.on_timer([](dispatch_time_t) {});
+        queue.reserve(messages);
+        for(long i = 0; i != messages; ++i) {
+            queue.post_delayed(i, std::chrono::milliseconds(-1));
+        }
+        auto start = std::chrono::steady_clock::now();
+        consume(queue);
+        auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / messages;
+        best = r == 0 ? ns : std::min(best, ns);
+    }
+    return best;
+}
+
+template <typename Backend>
+void bench(const char *name) {
+    long sum = 0;
+    big_capture big;
+    auto small_cb = [&sum](long &&v) { sum += v; };
+    auto big_cb = [&sum, big](long &&v) { sum += v + big.a[0]; };
+
+    auto get_function_small = run<Backend>([&](auto &queue) {
+        while(queue.get(std::function<void(long &&)>(small_cb))) {
+        }
+    });
+    auto get_template_small = run<Backend>([&](auto &queue) {
+        while(queue.get(small_cb)) {
+        }
+    });
+    auto get_function_big = run<Backend>([&](auto &queue) {
+        while(queue.get(std::function<void(long &&)>(big_cb))) {
+        }
+    });
+    auto get_template_big = run<Backend>([&](auto &queue) {
+        while(queue.get(big_cb)) {
+        }
+    });
+    auto all_function = run<Backend>([&](auto &queue) {
+        queue.get_all_due(std::function<void(long &&)>(big_cb));
+    });
+    auto all_template = run<Backend>([&](auto &queue) {
+        queue.get_all_due(big_cb);
+    });
+
+    std::printf("%s get() small capture   std::function %6.1f ns  template %6.1f ns\n", name, get_function_small,
+                get_template_small);
+    std::printf("%s get() big capture     std::function %6.1f ns  template %6.1f ns\n", name, get_function_big,
+                get_template_big);
+    std::printf("%s get_all_due()         std::function %6.1f ns  template %6.1f ns\n", name, all_function,
+                all_template);
+    std::printf("%s checksum %ld\n", name, sum);
+}
+
+} // namespace
+
+int main() {
+    bench<dispatch_list>("list");
+    bench<dispatch_heap>("heap");
+    return 0;
+}
@@ -5,7 +5,10 @@
 #ifndef MKS_BROADCASTER_H
 #define MKS_BROADCASTER_H
 
+#include <cstddef>
 #include <functional>
+#include <memory>
+#include <memory_resource>
 #include <unordered_map>
 #include <vector>
 #include <mutex>
@@ -15,7 +18,10 @@
 
 namespace mks {
 
-template<class Fp> class broadcaster;
+/**
+ * @tparam Alloc - allocator of listener maps, rebound to their node type
+ */
+template<class Fp, class Alloc = std::allocator<char>> class broadcaster;
 template<class Fp> class observer;
 
 template<class Fp>
@@ -143,27 +149,31 @@ public:
         cb();
     }
 
-    friend broadcaster<Rp(ArgTypes...)>;
+    template<class, class> friend class broadcaster;
 };
 
-template<class Rp, class ...ArgTypes>
-class broadcaster<Rp(ArgTypes...)> {
+template<class Rp, class ...ArgTypes, class Alloc>
+class broadcaster<Rp(ArgTypes...), Alloc> {
 public:
     using observer_t = observer<Rp(ArgTypes...)>;
+    using allocator_type = Alloc;
 
 private:
+    using map_t = std::unordered_map<uint64_t, observer_t*, std::hash<uint64_t>, std::equal_to<uint64_t>,
+        typename std::allocator_traits<Alloc>::template rebind_alloc<std::pair<const uint64_t, observer_t*>>>;
+
     mutable std::mutex mutex_;
     /*
      * We use raw pointers with respect only to this file
      * destructor of observer must always call cancel to remote itself from broadcaster
      */
     mutable bool listeners_iterating_ = false;
-    mutable typename std::unordered_map<uint64_t, observer_t*>::iterator active_iterator_;
-    mutable std::unordered_map<uint64_t, observer_t*> listeners_;
-    mutable std::unordered_map<uint64_t, observer_t*> new_listeners_;
+    mutable typename map_t::iterator active_iterator_;
+    mutable map_t listeners_;
+    mutable map_t new_listeners_;
     bool verbose_ = false;
 
-    bool remove_key(std::unordered_map<uint64_t, observer_t*>& map, uint64_t uid) {
+    bool remove_key(map_t& map, uint64_t uid) {
         auto it = map.find(uid);
         if(it != map.end()) {
             auto erase_it = map.erase(it);
@@ -259,6 +269,7 @@ private:
 
 public:
     broadcaster() = default;
+    explicit broadcaster(const Alloc& alloc) : listeners_(alloc), new_listeners_(alloc) {}
     broadcaster(broadcaster const&) = delete;
     broadcaster& operator=(broadcaster const&) = delete;
     broadcaster(broadcaster const&&) = delete;
@@ -315,5 +326,15 @@ public:
 
 };
 
+namespace pmr {
+
+/**
+ * broadcaster with listener maps in std::pmr::memory_resource, see pmr.h
+ */
+template<class Fp>
+using broadcaster = mks::broadcaster<Fp, std::pmr::polymorphic_allocator<std::byte>>;
+
+} // namespace pmr
+
 }
 #endif //MKS_BROADCASTER_H
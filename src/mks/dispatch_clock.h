@@ -0,0 +1,122 @@
+#ifndef MKS_DISPATCH_CLOCK_H
+#define MKS_DISPATCH_CLOCK_H
+
+/*
+ * Clocks usable as Clock parameter of dispatch_queue
+ *
+ *      dispatch_clock          - std::chrono::system_clock, default, follows wall time adjustments
+ *      std::chrono::steady_clock
+ *      dispatch_coarse_clock   - CLOCK_MONOTONIC_COARSE, resolution of the kernel tick (1-4ms), cheapest vDSO read
+ *      dispatch_tsc_clock      - x86 time stamp counter calibrated against steady_clock, no vDSO call at all
+ *
+ * coarse and tsc clocks fall back to steady_clock where they are not available
+ * timer callback of dispatch_queue always gets dispatch_time_t regardless of clock
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#ifdef __linux__
+#include <time.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define MKS_DISPATCH_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+using dispatch_clock = std::chrono::system_clock;
+using dispatch_time_t = dispatch_clock::duration;
+
+/**
+ * CLOCK_MONOTONIC_COARSE, same epoch as CLOCK_MONOTONIC
+ */
+struct dispatch_coarse_clock {
+    using duration = std::chrono::nanoseconds;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<dispatch_coarse_clock>;
+    static constexpr bool is_steady = true;
+
+    static time_point now() noexcept {
+#if defined(__linux__) && defined(CLOCK_MONOTONIC_COARSE)
+        timespec ts{};
+        ::clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return time_point(std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec));
+#else
+        return time_point(std::chrono::duration_cast<duration>(std::chrono::steady_clock::now().time_since_epoch()));
+#endif
+    }
+};
+
+/**
+ * Time stamp counter scaled to nanoseconds, epoch is the epoch of steady_clock
+ * calibration runs once on the first call to now() (~10ms), requires invariant TSC
+ * which is the case for every x86 CPU of the last decade
+ */
+struct dispatch_tsc_clock {
+    using duration = std::chrono::nanoseconds;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<dispatch_tsc_clock>;
+    static constexpr bool is_steady = true;
+
+    static time_point now() noexcept {
+#ifdef MKS_DISPATCH_TSC
+        const auto &c = calibration::get();
+        auto ticks = static_cast<double>(static_cast<int64_t>(read_tsc() - c.base_tsc));
+        return time_point(duration(c.base_ns + static_cast<rep>(ticks * c.ns_per_tick)));
+#else
+        return time_point(std::chrono::duration_cast<duration>(std::chrono::steady_clock::now().time_since_epoch()));
+#endif
+    }
+
+#ifdef MKS_DISPATCH_TSC
+    /**
+     * Nanoseconds per counter tick measured by calibration
+     */
+    static double ns_per_tick() {
+        return calibration::get().ns_per_tick;
+    }
+
+private:
+    struct calibration {
+        uint64_t base_tsc = 0;
+        rep base_ns = 0;
+        double ns_per_tick = 1.0;
+
+        calibration() {
+            using steady = std::chrono::steady_clock;
+            auto ns = [](steady::time_point t) {
+                return std::chrono::duration_cast<duration>(t.time_since_epoch()).count();
+            };
+            auto start = steady::now();
+            auto start_tsc = read_tsc();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            auto end = steady::now();
+            auto end_tsc = read_tsc();
+            if(end_tsc > start_tsc && end > start) {
+                ns_per_tick = static_cast<double>(ns(end) - ns(start)) / static_cast<double>(end_tsc - start_tsc);
+            }
+            base_tsc = end_tsc;
+            base_ns = ns(end);
+        }
+
+        static const calibration &get() {
+            static const calibration c;
+            return c;
+        }
+    };
+
+    static uint64_t read_tsc() noexcept {
+        return __rdtsc();
+    }
+#endif
+};
+
+#endif // MKS_DISPATCH_CLOCK_H
@@ -0,0 +1,223 @@
+#ifndef MKS_DISPATCH_HEAP_H
+#define MKS_DISPATCH_HEAP_H
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "dispatch_stats.h"
+
+/*
+ * 4-ary min heap ordering backend for dispatch_queue
+ *
+ * exact ordering by deadline, equal deadlines keep insertion order
+ * heap lives in contiguous array of {when, sequence, message} so sift operations compare
+ * without touching the messages, every message keeps its heap position in dispatch_message::index
+ * insert/erase O(log n), next deadline O(1)
+ */
+
+template <typename M>
+class dispatch_heap_order {
+public:
+    using time_point = typename M::time_point;
+
+private:
+    static constexpr std::size_t arity = 4;
+
+    struct entry {
+        time_point when;
+        std::uint64_t seq;
+        M *msg;
+    };
+
+    std::vector<entry> heap_;
+    std::uint64_t seq_ = 0;
+
+    // result of coalesced_deadline(), lowered on insert, recomputed after erase of a message it depends on
+    time_point bound_{};
+    bool bound_valid_ = false;
+
+    static bool less(const entry &a, const entry &b) {
+        return a.when < b.when || (a.when == b.when && a.seq < b.seq);
+    }
+
+    void set(std::size_t pos, const entry &e) {
+        heap_[pos] = e;
+        e.msg->index = pos;
+    }
+
+    std::size_t sift_up(std::size_t pos) {
+        auto e = heap_[pos];
+        std::size_t steps = 0;
+        while(pos > 0) {
+            auto parent = (pos - 1) / arity;
+            if(!less(e, heap_[parent])) {
+                break;
+            }
+            set(pos, heap_[parent]);
+            pos = parent;
+            ++steps;
+        }
+        set(pos, e);
+        return steps;
+    }
+
+    void sift_down(std::size_t pos) {
+        auto e = heap_[pos];
+        auto size = heap_.size();
+        for(;;) {
+            auto first = pos * arity + 1;
+            if(first >= size) {
+                break;
+            }
+            auto last = first + arity < size ? first + arity : size;
+            auto best = first;
+            for(auto child = first + 1; child < last; ++child) {
+                if(less(heap_[child], heap_[best])) {
+                    best = child;
+                }
+            }
+            if(!less(heap_[best], e)) {
+                break;
+            }
+            set(pos, heap_[best]);
+            pos = best;
+        }
+        set(pos, e);
+    }
+
+    /**
+     * Children are never due before parent, subtree is skipped once its root is not due before current bound
+     */
+    void coalesce(std::size_t pos, time_point &when) const {
+        if(heap_[pos].when >= when) {
+            return;
+        }
+        if(heap_[pos].msg->latest < when) {
+            when = heap_[pos].msg->latest;
+        }
+        auto first = pos * arity + 1;
+        for(auto child = first; child < first + arity && child < heap_.size(); ++child) {
+            coalesce(child, when);
+        }
+    }
+
+public:
+    dispatch_insert insert(M *msg) {
+        heap_.push_back(entry{msg->when, seq_++, msg});
+        msg->index = heap_.size() - 1;
+        dispatch_insert ret;
+        ret.steps = sift_up(heap_.size() - 1);
+        if(msg->index == 0) {
+            ret.where = dispatch_insert::head;
+        } else if(ret.steps != 0) {
+            ret.where = dispatch_insert::middle;
+        }
+        if(heap_.size() == 1) {
+            bound_ = msg->latest;
+            bound_valid_ = true;
+        } else if(bound_valid_ && msg->when < bound_ && msg->latest < bound_) {
+            bound_ = msg->latest;
+        }
+        return ret;
+    }
+
+    template <class F>
+    void insert_sorted(M *const *first, M *const *last, F &&on_insert) {
+        for(; first != last; ++first) {
+            on_insert(insert(*first));
+        }
+    }
+
+    void erase(M *msg) {
+        auto pos = msg->index;
+        assert(pos < heap_.size() && heap_[pos].msg == msg);
+        if(msg->when <= bound_) {
+            bound_valid_ = false;
+        }
+        auto last = heap_.size() - 1;
+        if(pos != last) {
+            auto moved = heap_[last];
+            heap_.pop_back();
+            set(pos, moved);
+            if(pos > 0 && less(moved, heap_[(pos - 1) / arity])) {
+                sift_up(pos);
+            } else {
+                sift_down(pos);
+            }
+        } else {
+            heap_.pop_back();
+        }
+        msg->prev_message = nullptr;
+        msg->next_message = nullptr;
+    }
+
+    M *pop_due(const time_point &now) {
+        if(heap_.empty() || now < heap_.front().when) {
+            return nullptr;
+        }
+        return pop_any();
+    }
+
+    /**
+     * Message pop_due() would return, left in the order
+     */
+    M *peek_due(const time_point &now) {
+        if(heap_.empty() || now < heap_.front().when) {
+            return nullptr;
+        }
+        return heap_.front().msg;
+    }
+
+    M *pop_any() {
+        if(heap_.empty()) {
+            return nullptr;
+        }
+        auto *msg = heap_.front().msg;
+        erase(msg);
+        return msg;
+    }
+
+    bool next_deadline(time_point &when) const {
+        if(heap_.empty()) {
+            return false;
+        }
+        when = heap_.front().when;
+        return true;
+    }
+
+    /**
+     * Latest wakeup satisfying slack of all messages, heap is walked only after the head
+     * or other message below the bound was removed
+     */
+    bool coalesced_deadline(time_point &when) {
+        if(heap_.empty()) {
+            return false;
+        }
+        if(!bound_valid_) {
+            bound_ = heap_.front().msg->latest;
+            coalesce(0, bound_);
+            bound_valid_ = true;
+        }
+        when = bound_;
+        return true;
+    }
+
+    std::size_t size() const {
+        return heap_.size();
+    }
+
+    void reserve(std::size_t size) {
+        heap_.reserve(size);
+    }
+};
+
+/**
+ * Backend selector for dispatch_queue
+ */
+struct dispatch_heap {
+    template <typename M>
+    using order = dispatch_heap_order<M>;
+};
+
+#endif // MKS_DISPATCH_HEAP_H
@@ -8,31 +8,100 @@
 /*
  * Dispatch queue used for scheduling callbacks at some delays
  * dispatch_queue is not THREAD SAFE, and should be used with some synchronization to ensure correct scheduling
+ *
+ * ordering of pending messages is done by Backend:
+ *      dispatch_list    - sorted double linked list, exact order, O(n) insert of out of order deadline (default)
+ *      dispatch_heap    - 4-ary heap in contiguous array, exact order, O(log n) insert/remove
+ *      dispatch_wheel<> - hierarchical timing wheel, O(1) insert/remove, deadlines rounded up to the tick
+ *
+ * post_*() returns dispatch_handle, remove() of handle of already dispatched or removed message is a no-op
+ *
+ * Clock is system_clock by default, see dispatch_clock.h for steady/coarse/tsc clocks
+ * Stats is instrumentation policy, see dispatch_stats.h
+ *
+ * dispatch_queue<int, dispatch_wheel<std::chrono::milliseconds, 4, 8>> queue;
+ * dispatch_queue<int, dispatch_heap, dispatch_coarse_clock> coarse_queue;
  */
 
 #include <algorithm>
+#include <cassert>
 #include <chrono>
 #include <cstdint>
 #include <deque>
 #include <functional>
+#include <limits>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include <date/date.h>
 #include <date/tz.h>
 
 #include <mks/log.h>
 
-using dispatch_clock = std::chrono::system_clock;
-using dispatch_time_t = dispatch_clock::duration;
+#include "dispatch_clock.h"
+#include "dispatch_heap.h"
+#include "dispatch_stats.h"
+#include "dispatch_wheel.h"
 
-template <class T>
+/**
+ * Re-arm policy of periodic messages when dispatch is late by more than one interval
+ *      fixed_rate_catch_up - next deadline is previous + interval, missed runs are dispatched back to back
+ *      fixed_rate_skip     - missed runs are dropped, next deadline stays aligned to the original schedule
+ *      fixed_delay         - next deadline is interval after the callback returned
+ */
+enum class dispatch_periodic : uint8_t { fixed_rate_catch_up, fixed_rate_skip, fixed_delay };
+
+/**
+ * Handle of posted message, slot of the message in the pool and generation of the slot
+ * generation changes when message is returned to the pool so stale handle never matches recycled message
+ */
+struct dispatch_handle {
+    static constexpr uint32_t invalid_slot = std::numeric_limits<uint32_t>::max();
+
+    uint32_t slot = invalid_slot;
+    uint32_t gen = 0;
+
+    explicit operator bool() const {
+        return slot != invalid_slot;
+    }
+
+    bool operator==(const dispatch_handle &other) const {
+        return slot == other.slot && gen == other.gen;
+    }
+
+    bool operator!=(const dispatch_handle &other) const {
+        return !(*this == other);
+    }
+};
+
+template <class T, class Clock = dispatch_clock>
 struct dispatch_message {
-    dispatch_message<T> *prev_message = nullptr;
-    dispatch_message<T> *next_message = nullptr;
+    using clock = Clock;
+    using time_point = typename Clock::time_point;
+
+    dispatch_message<T, Clock> *prev_message = nullptr;
+    dispatch_message<T, Clock> *next_message = nullptr;
     bool in_use = false;
+    // periodic message is being dispatched, remove() only stops re-arming
+    bool firing = false;
+    dispatch_periodic policy = dispatch_periodic::fixed_rate_catch_up;
+    // position of the message inside ordering backend (heap index, bucket of the wheel)
+    std::size_t index = 0;
+    // slot in dispatch_pool, see dispatch_handle
+    uint32_t slot = dispatch_handle::invalid_slot;
+    // get_all_due() batch current when the message was posted, see dispatch_queue::batch_id_
+    uint32_t batch = 0;
 
     T val;
-    dispatch_clock::time_point when;
+    time_point when;
+    // when + slack, latest time the message may be dispatched when wakeups are coalesced
+    time_point latest;
+    // zero for one shot messages
+    typename Clock::duration interval{};
 
     explicit dispatch_message(const T &val) : val(val) {}
     explicit dispatch_message(T &&val) : val(std::move(val)) {}
@@ -40,18 +109,37 @@ struct dispatch_message {
 
 /**
  * Dispatch message pool for reusing messages passed to the dispatch_queue
- * internally we use same double linked list capabilities from dispatch_message
- * just without time information
+ * messages live in slabs of chunk_size messages which are never freed individually,
+ * idle messages are kept constructed in double linked list using dispatch_message links
+ * every slot has generation counter which outlives the slab, see dispatch_handle
  * @tparam T - object saved
- * @tparam MAX_OBJECTS - maximum size of the pool before objects are discarded
+ * @tparam MAX_OBJECTS - default limit of idle messages, messages over limit are destroyed and their slots reused
+ * @tparam Clock - clock of the messages
  */
-template <typename T, std::size_t MAX_OBJECTS>
+template <typename T, std::size_t MAX_OBJECTS, typename Clock = dispatch_clock>
 class dispatch_pool {
+    using message_t = dispatch_message<T, Clock>;
+
+    static constexpr std::size_t chunk_bits = 8;
+    static constexpr std::size_t chunk_size = std::size_t(1) << chunk_bits;
+
+    struct chunk {
+        typename std::aligned_storage<sizeof(message_t), alignof(message_t)>::type slots[chunk_size];
+        // constructed messages, idle or posted
+        std::size_t live = 0;
+    };
+
     std::size_t size_ = 0;
-    dispatch_message<T> *head_message_ = nullptr;
-    dispatch_message<T> *tail_message_ = nullptr;
+    std::size_t max_size_ = MAX_OBJECTS;
+    message_t *head_message_ = nullptr;
+    message_t *tail_message_ = nullptr;
+
+    std::vector<std::unique_ptr<chunk>> chunks_;
+    std::vector<uint32_t> gens_;
+    // slots without constructed message
+    std::vector<uint32_t> raw_slots_;
 
-    bool enqueue(dispatch_message<T> *message) {
+    bool enqueue(message_t *message) {
         assert(!message->in_use);
         message->in_use = false;
         if(head_message_ == nullptr) {
@@ -72,7 +160,7 @@ class dispatch_pool {
         return true;
     }
 
-    dispatch_message<T> *dequeue() {
+    message_t *dequeue() {
         auto message = head_message_;
         if(message != nullptr) {
             head_message_ = message->next_message;
@@ -87,17 +175,64 @@ class dispatch_pool {
         return nullptr;
     }
 
+    void *storage(uint32_t slot) const {
+        return &chunks_[slot >> chunk_bits]->slots[slot & (chunk_size - 1)];
+    }
+
+    void grow() {
+        std::size_t index = 0;
+        while(index < chunks_.size() && chunks_[index] != nullptr) {
+            ++index;
+        }
+        assert((index + 1) * chunk_size < dispatch_handle::invalid_slot);
+        if(index == chunks_.size()) {
+            chunks_.emplace_back();
+        }
+        chunks_[index].reset(new chunk());
+        if(gens_.size() < (index + 1) * chunk_size) {
+            gens_.resize((index + 1) * chunk_size);
+        }
+        // lowest slot is used first
+        for(auto slot = (index + 1) * chunk_size; slot-- > index * chunk_size;) {
+            raw_slots_.push_back(static_cast<uint32_t>(slot));
+        }
+    }
+
+    template <class V>
+    message_t *construct(V &&val) {
+        if(raw_slots_.empty()) {
+            grow();
+        }
+        auto slot = raw_slots_.back();
+        raw_slots_.pop_back();
+        auto *message = new(storage(slot)) message_t(std::forward<V>(val));
+        message->slot = slot;
+        ++chunks_[slot >> chunk_bits]->live;
+        return message;
+    }
+
 public:
+    dispatch_pool() = default;
+    dispatch_pool(const dispatch_pool &) = delete;
+    dispatch_pool &operator=(const dispatch_pool &) = delete;
+
     ~dispatch_pool() {
         while(!empty()) {
             auto *pv = dequeue();
             MKS_ASSERT(pv != nullptr);
-            delete pv;
+            pv->~message_t();
         }
     }
 
-    std::size_t max_size() {
-        return MAX_OBJECTS;
+    std::size_t max_size() const {
+        return max_size_;
+    }
+
+    /**
+     * Limit of idle messages, takes effect on next put()
+     */
+    void set_max_size(std::size_t max_size) {
+        max_size_ = max_size;
     }
 
     std::size_t size() const {
@@ -108,29 +243,117 @@ public:
         return size() == 0;
     }
 
-    void put(dispatch_message<T> *val) {
-        if(size() >= MAX_OBJECTS) {
-            delete val;
+    /**
+     * Slots in allocated slabs
+     */
+    std::size_t capacity() const {
+        std::size_t ret = 0;
+        for(auto &c : chunks_) {
+            ret += c != nullptr ? chunk_size : 0;
+        }
+        return ret;
+    }
+
+    /**
+     * Construct idle messages up to n so next n get() calls do not allocate, raises limit to n
+     */
+    void reserve(std::size_t n) {
+        if(max_size_ < n) {
+            max_size_ = n;
+        }
+        while(size_ < n) {
+            enqueue(construct(T()));
+        }
+    }
+
+    /**
+     * Destroy idle messages and free slabs without posted messages
+     */
+    void trim() {
+        while(!empty()) {
+            destroy(dequeue());
+        }
+        for(auto &c : chunks_) {
+            if(c != nullptr && c->live == 0) {
+                c.reset();
+            }
+        }
+        while(!chunks_.empty() && chunks_.back() == nullptr) {
+            chunks_.pop_back();
+        }
+        raw_slots_.erase(std::remove_if(raw_slots_.begin(), raw_slots_.end(),
+                                        [this](uint32_t slot) {
+                                            auto index = slot >> chunk_bits;
+                                            return index >= chunks_.size() || chunks_[index] == nullptr;
+                                        }),
+                         raw_slots_.end());
+    }
+
+    /**
+     * Destroy message instead of reusing it, handles of the message become stale
+     */
+    void destroy(message_t *val) {
+        auto slot = val->slot;
+        ++gens_[slot];
+        val->~message_t();
+        --chunks_[slot >> chunk_bits]->live;
+        raw_slots_.push_back(slot);
+    }
+
+    dispatch_handle handle(const message_t *val) const {
+        return dispatch_handle{val->slot, gens_[val->slot]};
+    }
+
+    /**
+     * @return message of the handle or nullptr when handle is stale
+     */
+    message_t *find(const dispatch_handle &h) const {
+        if(h.slot >= gens_.size() || gens_[h.slot] != h.gen) {
+            return nullptr;
+        }
+        auto index = h.slot >> chunk_bits;
+        if(index >= chunks_.size() || chunks_[index] == nullptr) {
+            return nullptr;
+        }
+        return std::launder(reinterpret_cast<message_t *>(storage(h.slot)));
+    }
+
+    void put(message_t *val) {
+        if(size() >= max_size_) {
+            destroy(val);
             return;
         }
+        ++gens_[val->slot];
         val->next_message = nullptr;
         val->prev_message = nullptr;
+        val->interval = {};
         val->val = T();
         enqueue(val);
     }
 
-    dispatch_message<T> *get(T &&val) {
+    /**
+     * Return chain of messages linked by next_message
+     */
+    void put_all(message_t *head) {
+        while(head != nullptr) {
+            auto *next = head->next_message;
+            put(head);
+            head = next;
+        }
+    }
+
+    message_t *get(T &&val) {
         if(empty()) {
-            return new dispatch_message<T>(std::forward<T>(val));
+            return construct(std::move(val));
         }
         auto *pv = dequeue();
         pv->val = std::forward<T>(val);
         return pv;
     }
 
-    dispatch_message<T> *get(const T &val) {
+    message_t *get(const T &val) {
         if(empty()) {
-            return new dispatch_message<T>(val);
+            return construct(val);
         }
         auto *pv = dequeue();
         pv->val = val;
@@ -138,70 +361,38 @@ public:
     }
 };
 
-template <typename T>
-class dispatch_queue {
+/**
+ * Sorted double linked list, new message is inserted by walking backwards from the tail
+ * so monotonic deadlines are O(1), out of order deadlines O(n)
+ * @tparam M - dispatch_message
+ */
+template <typename M>
+class dispatch_list_order {
     std::size_t size_ = 0;
-    dispatch_message<T> *head_message_ = nullptr;
-    dispatch_message<T> *tail_message_ = nullptr;
+    M *head_message_ = nullptr;
+    M *tail_message_ = nullptr;
 
-    dispatch_pool<T, 1024> msg_pool_;
-
-    std::function<void(dispatch_time_t)> run_timer_cb_;
-
-    static dispatch_clock::time_point now() {
-        return dispatch_clock::now();
-    }
+public:
+    using time_point = typename M::time_point;
 
-    void signal_timer(dispatch_time_t time) {
-        assert(run_timer_cb_);
-        run_timer_cb_(time);
-    }
+private:
+    // result of coalesced_deadline(), lowered on insert, recomputed after erase of a message it depends on
+    time_point bound_{};
+    bool bound_valid_ = false;
 
-    dispatch_message<T> *dequeue_head() {
-        auto message = head_message_;
-        if(message != nullptr) {
-            head_message_ = message->next_message;
-            if(head_message_ != nullptr) {
-                head_message_->prev_message = nullptr;
-            }
-            message->prev_message = nullptr;
-            message->next_message = nullptr;
-            --size_;
-            assert(message->in_use);
-            message->in_use = false;
-            return message;
+    void lower_bound(const M *message) {
+        if(size_ == 1) {
+            bound_ = message->latest;
+            bound_valid_ = true;
+        } else if(bound_valid_ && message->when < bound_ && message->latest < bound_) {
+            bound_ = message->latest;
         }
-        return nullptr;
     }
 
-    dispatch_message<T> *dequeue() {
-        auto now = dispatch_clock::now();
-        auto message = head_message_;
-        if(message != nullptr) {
-            if(now < message->when) {
-                signal_timer(message->when - now);
-                return nullptr;
-            } else {
-                head_message_ = message->next_message;
-                if(head_message_ != nullptr) {
-                    head_message_->prev_message = nullptr;
-                }
-                message->prev_message = nullptr;
-                message->next_message = nullptr;
-                assert(size_ > 0);
-                --size_;
-                assert(message->in_use);
-                message->in_use = false;
-                return message;
-            }
-        }
-        return nullptr;
-    }
-
-    bool enqueue(dispatch_message<T> *message) {
-        assert(!message->in_use);
-        message->in_use = true;
+public:
+    dispatch_insert insert(M *message) {
         auto &when = message->when;
+        dispatch_insert ret;
         if(head_message_ == nullptr || when < head_message_->when) {
             auto old_head_message = head_message_;
             head_message_ = message;
@@ -211,16 +402,18 @@ class dispatch_queue {
                 tail_message_ = head_message_;
             }
             head_message_->next_message = old_head_message;
+            ret.where = dispatch_insert::head;
         } else if(when >= tail_message_->when) {
             message->prev_message = tail_message_;
             tail_message_->next_message = message;
             tail_message_ = message;
         } else {
             auto *current_message = tail_message_;
-            dispatch_message<T> *next_message = nullptr;
+            M *next_message = nullptr;
             for(;;) {
                 next_message = current_message;
                 current_message = current_message->prev_message;
+                ++ret.steps;
                 if(when >= current_message->when) {
                     break;
                 }
@@ -229,24 +422,358 @@ class dispatch_queue {
             message->prev_message = current_message;
             next_message->prev_message = message;
             current_message->next_message = message;
+            ret.where = dispatch_insert::middle;
         }
         size_++;
-        return true;
+        lower_bound(message);
+        return ret;
     }
 
-    void schedule_timer() {
-        auto now = dispatch_clock::now();
+    /**
+     * Merge messages sorted by when in one pass, starts at position of the first one found from the tail
+     * @param on_insert - called with dispatch_insert of every message
+     */
+    template <class F>
+    void insert_sorted(M *const *first, M *const *last, F &&on_insert) {
+        if(first == last) {
+            return;
+        }
+        // new message is linked before cur, nullptr is behind the tail
+        M *cur = nullptr;
+        std::size_t steps = 0;
+        for(auto *msg = tail_message_; msg != nullptr && (*first)->when < msg->when; msg = msg->prev_message) {
+            cur = msg;
+            ++steps;
+        }
+        for(; first != last; ++first) {
+            auto *message = *first;
+            while(cur != nullptr && cur->when <= message->when) {
+                cur = cur->next_message;
+                ++steps;
+            }
+            dispatch_insert info;
+            info.steps = steps;
+            message->next_message = cur;
+            if(cur == nullptr) {
+                message->prev_message = tail_message_;
+                if(tail_message_ != nullptr) {
+                    tail_message_->next_message = message;
+                } else {
+                    head_message_ = message;
+                }
+                tail_message_ = message;
+                info.where = dispatch_insert::tail;
+            } else {
+                message->prev_message = cur->prev_message;
+                if(cur->prev_message != nullptr) {
+                    cur->prev_message->next_message = message;
+                    info.where = dispatch_insert::middle;
+                } else {
+                    head_message_ = message;
+                    info.where = dispatch_insert::head;
+                }
+                cur->prev_message = message;
+            }
+            size_++;
+            lower_bound(message);
+            on_insert(info);
+            steps = 0;
+        }
+    }
+
+    void erase(M *msg) {
+        if(msg->when <= bound_) {
+            bound_valid_ = false;
+        }
+        auto *prev = msg->prev_message;
+        auto *next = msg->next_message;
+        if(prev != nullptr) {
+            prev->next_message = next;
+        }
+        if(next != nullptr) {
+            next->prev_message = prev;
+        }
+        msg->prev_message = nullptr;
+        msg->next_message = nullptr;
+        if(msg == head_message_) {
+            head_message_ = next;
+        }
+        if(msg == tail_message_) {
+            tail_message_ = prev;
+        }
+        assert(size_ > 0);
+        --size_;
+    }
+
+    M *pop_due(const time_point &now) {
+        if(head_message_ == nullptr || now < head_message_->when) {
+            return nullptr;
+        }
+        return pop_any();
+    }
+
+    /**
+     * Message pop_due() would return, left in the order
+     */
+    M *peek_due(const time_point &now) {
+        if(head_message_ == nullptr || now < head_message_->when) {
+            return nullptr;
+        }
+        return head_message_;
+    }
+
+    M *pop_any() {
         auto message = head_message_;
         if(message != nullptr) {
-            if(now < message->when) {
-                auto diff = message->when - now;
-                signal_timer(diff);
+            erase(message);
+        }
+        return message;
+    }
+
+    bool next_deadline(time_point &when) const {
+        if(head_message_ == nullptr) {
+            return false;
+        }
+        when = head_message_->when;
+        return true;
+    }
+
+    /**
+     * Latest wakeup satisfying slack of all messages, walks only messages due before it,
+     * message due exactly at the bound can not lower it so equal deadlines are not walked
+     * the walk is done only after the head or other message below the bound was removed
+     */
+    bool coalesced_deadline(time_point &when) {
+        if(head_message_ == nullptr) {
+            return false;
+        }
+        if(!bound_valid_) {
+            bound_ = head_message_->latest;
+            for(auto *msg = head_message_->next_message; msg != nullptr && msg->when < bound_; msg = msg->next_message) {
+                if(msg->latest < bound_) {
+                    bound_ = msg->latest;
+                }
+            }
+            bound_valid_ = true;
+        }
+        when = bound_;
+        return true;
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+};
+
+/**
+ * Backend selector for dispatch_queue, see dispatch_heap and dispatch_wheel for the alternatives
+ */
+struct dispatch_list {
+    template <typename M>
+    using order = dispatch_list_order<M>;
+};
+
+template <typename T, typename Backend = dispatch_list, typename Clock = dispatch_clock,
+          typename Stats = dispatch_no_stats>
+class dispatch_queue {
+public:
+    using clock = Clock;
+    using time_point = typename Clock::time_point;
+    using message_t = dispatch_message<T, Clock>;
+
+private:
+    using order_t = typename Backend::template order<message_t>;
+
+    order_t order_;
+
+    dispatch_pool<T, 1024, Clock> msg_pool_;
+
+    std::function<void(dispatch_time_t)> run_timer_cb_;
+
+    Stats stats_;
+
+    // deadlines merged by slack into wakeup of an earlier one, each would need own wakeup otherwise
+    std::size_t wakeups_saved_ = 0;
+
+    // head deadline and coalesced deadline of the last armed timer, deadlines between them share the wakeup
+    time_point armed_head_{};
+    time_point armed_bound_{};
+
+    // set while get_all_due() runs callbacks, timer is re-armed once after the batch
+    bool dispatching_ = false;
+
+    // incremented by every get_all_due(), messages posted since then carry it and end the batch
+    uint32_t batch_id_ = 0;
+
+    // scratch of post_batch()
+    std::vector<message_t *> batch_;
+
+    static time_point now() {
+        return Clock::now();
+    }
+
+    template <class Duration>
+    void signal_timer(const Duration &time) {
+        assert(run_timer_cb_);
+        // rounded up so timer never expires before the deadline
+        run_timer_cb_(std::chrono::ceil<dispatch_time_t>(time));
+    }
+
+    message_t *dequeue_head() {
+        auto message = order_.pop_any();
+        if(message != nullptr) {
+            assert(message->in_use);
+            message->in_use = false;
+        }
+        return message;
+    }
+
+    message_t *dequeue() {
+        auto now = Clock::now();
+        auto message = order_.pop_due(now);
+        if(message != nullptr) {
+            assert(message->in_use);
+            message->in_use = false;
+            stats_.on_dispatch(now - message->when, order_.size());
+            return message;
+        }
+        arm_timer(now);
+        return nullptr;
+    }
+
+    void arm_timer(const time_point &now) {
+        time_point when;
+        if(order_.coalesced_deadline(when)) {
+            order_.next_deadline(armed_head_);
+            armed_bound_ = when;
+            if(now < when) {
+                signal_timer(when - now);
             } else {
                 signal_timer(dispatch_time_t{0});
             }
         }
     }
 
+    bool enqueue(message_t *message) {
+        assert(!message->in_use);
+        message->in_use = true;
+        stats_.on_insert(order_.insert(message), order_.size());
+        return true;
+    }
+
+    template <class V>
+    message_t *acquire(V &&val) {
+        stats_.on_pool(!msg_pool_.empty());
+        auto *msg = msg_pool_.get(std::forward<V>(val));
+        msg->batch = batch_id_;
+        return msg;
+    }
+
+    /**
+     * Dispatch message removed from the order, periodic message is re-armed in place
+     * @return true when message is done and can be returned to the pool
+     */
+    template <class F>
+    bool fire(message_t *msg, F &cb) {
+        constexpr bool takes_rvalue = std::is_invocable<F &, T &&>::value;
+        static_assert(takes_rvalue || std::is_invocable<F &, const T &>::value, "callback must accept T&& or const T&");
+        if(msg->interval == Clock::duration::zero()) {
+            if constexpr(takes_rvalue) {
+                cb(std::move(msg->val));
+            } else {
+                auto val = std::move(msg->val);
+                cb(static_cast<const T &>(val));
+            }
+            return true;
+        }
+        if constexpr(std::is_copy_constructible<T>::value) {
+            msg->firing = true;
+            if constexpr(takes_rvalue) {
+                T val(msg->val);
+                cb(std::move(val));
+            } else {
+                cb(static_cast<const T &>(msg->val));
+            }
+            msg->firing = false;
+        }
+        return !rearm(msg);
+    }
+
+    bool rearm(message_t *msg) {
+        // interval is cleared by remove() called from the callback
+        if(msg->interval == Clock::duration::zero()) {
+            return false;
+        }
+        auto slack = msg->latest - msg->when;
+        switch(msg->policy) {
+        case dispatch_periodic::fixed_rate_catch_up:
+            msg->when += msg->interval;
+            break;
+        case dispatch_periodic::fixed_rate_skip: {
+            msg->when += msg->interval;
+            auto now = Clock::now();
+            if(msg->when <= now) {
+                msg->when += ((now - msg->when) / msg->interval + 1) * msg->interval;
+            }
+            break;
+        }
+        case dispatch_periodic::fixed_delay:
+            msg->when = Clock::now() + msg->interval;
+            break;
+        }
+        msg->latest = msg->when + slack;
+        enqueue(msg);
+        return true;
+    }
+
+    void schedule_timer() {
+        if(dispatching_) {
+            return;
+        }
+        arm_timer(Clock::now());
+    }
+
+    /**
+     * Batch of get()/get_all_due(), returns dispatched messages to the pool and re-arms the timer
+     * also when callback throws, message of the throwing callback (periodic too) is dropped
+     */
+    class batch_guard {
+        dispatch_queue &queue_;
+        message_t *done_head_ = nullptr;
+        message_t *done_tail_ = nullptr;
+
+    public:
+        // message whose callback runs, not in the order nor in the done list
+        message_t *firing = nullptr;
+
+        explicit batch_guard(dispatch_queue &queue) : queue_(queue) {
+            queue_.dispatching_ = true;
+            ++queue_.batch_id_;
+        }
+
+        batch_guard(const batch_guard &) = delete;
+        batch_guard &operator=(const batch_guard &) = delete;
+
+        ~batch_guard() {
+            queue_.dispatching_ = false;
+            if(firing != nullptr) {
+                firing->firing = false;
+                done(firing);
+            }
+            queue_.msg_pool_.put_all(done_head_);
+            queue_.schedule_timer();
+        }
+
+        void done(message_t *msg) {
+            if(done_tail_ != nullptr) {
+                done_tail_->next_message = msg;
+            } else {
+                done_head_ = msg;
+            }
+            done_tail_ = msg;
+        }
+    };
+
 public:
     ~dispatch_queue() {
         MKS_ASSERT(empty());
@@ -259,100 +786,289 @@ public:
         */
     }
 
+    /**
+     * @param slack - message may be dispatched up to slack after its deadline, wakeup is delayed
+     *                to the latest time satisfying all pending messages so close deadlines share it
+     */
     template <class Rep, class Period>
-    dispatch_message<T>* post_delayed(const T &arg, const std::chrono::duration<Rep, Period> &time) {
-        auto *msg = msg_pool_.get(arg);
+    dispatch_handle post_delayed(const T &arg, const std::chrono::duration<Rep, Period> &time, typename Clock::duration slack = {}) {
+        auto *msg = acquire(arg);
         msg->when = now() + time;
+        msg->latest = msg->when + slack;
         enqueue(msg);
         schedule_timer();
-        return msg;
+        return msg_pool_.handle(msg);
     }
 
     template <class Rep, class Period>
-    dispatch_message<T>* post_delayed(T &&arg, const std::chrono::duration<Rep, Period> &time) {
-        auto *msg = msg_pool_.get(std::move(arg));
+    dispatch_handle post_delayed(T &&arg, const std::chrono::duration<Rep, Period> &time, typename Clock::duration slack = {}) {
+        auto *msg = acquire(std::move(arg));
         msg->when = now() + time;
+        msg->latest = msg->when + slack;
         enqueue(msg);
         schedule_timer();
-        return msg;
+        return msg_pool_.handle(msg);
     }
 
-    template <class Clock, class Duration>
-    dispatch_message<T>* post_at(const T &arg, const std::chrono::time_point<Clock, Duration> &time) {
-        auto *msg = msg_pool_.get(arg);
+    template <class Duration>
+    dispatch_handle post_at(const T &arg, const std::chrono::time_point<Clock, Duration> &time) {
+        auto *msg = acquire(arg);
         msg->when = time;
+        msg->latest = msg->when;
         enqueue(msg);
         schedule_timer();
-        return msg;
+        return msg_pool_.handle(msg);
     }
 
-    template <class Clock, class Duration>
-    dispatch_message<T>* post_at(T &&arg, const std::chrono::time_point<Clock, Duration> &time) {
-        auto *msg = msg_pool_.get(std::move(arg));
+    template <class Duration>
+    dispatch_handle post_at(T &&arg, const std::chrono::time_point<Clock, Duration> &time) {
+        auto *msg = acquire(std::move(arg));
         msg->when = time;
+        msg->latest = msg->when;
+        enqueue(msg);
+        schedule_timer();
+        return msg_pool_.handle(msg);
+    }
+
+    /**
+     * Intrusive interface for messages owned by the caller (see dispatch_queue_mpsc), message is linked
+     * into the order as is and never touches the pool, caller sets val, when and latest,
+     * queue using it must not mix in pooled messages
+     */
+    void post_message(message_t *msg) {
+        msg->batch = batch_id_;
         enqueue(msg);
         schedule_timer();
-        return msg;
     }
 
-    void remove(dispatch_message<T>* msg) {
+    /**
+     * Unlink caller owned message posted by post_message()
+     */
+    void remove_message(message_t *msg) {
         assert(msg->in_use);
-        auto* prev = msg->prev_message;
-        auto* next = msg->next_message;
-        if(prev != nullptr) {
-            prev->next_message = next;
-        }
-        if(next != nullptr) {
-            next->prev_message = prev;
-        }
-        msg->prev_message = nullptr;
-        msg->next_message = nullptr;
+        order_.erase(msg);
         msg->in_use = false;
-        if(msg == head_message_) {
-            head_message_ = prev;
-        } else if(msg == tail_message_) {
-            tail_message_ = next;
-        }
-        assert(size_ > 0);
-        --size_;
-        msg_pool_.put(msg);
+        stats_.on_remove(order_.size());
         schedule_timer();
     }
 
-    void get(std::function<void(const T &)> cb) {
+    /**
+     * Unlink due caller owned message, timer is re-armed
+     * @return nullptr when nothing is due
+     */
+    message_t *get_message() {
         auto *msg = dequeue();
         if(msg != nullptr) {
-            auto val = std::move(msg->val);
-            cb(val);
-            msg_pool_.put(msg);
             schedule_timer();
         }
+        return msg;
+    }
+
+    /**
+     * Unlink any caller owned message without touching the timer, for teardown
+     */
+    message_t *take_message() {
+        return dequeue_head();
+    }
+
+    /**
+     * Post many messages at once, clock is read once, messages are sorted and merged into the order
+     * in one pass and timer is signalled once
+     * @param items - range of pair-like (value, delay), values are moved from rvalue range
+     * @return handles in the order of items
+     */
+    template <class Range>
+    std::vector<dispatch_handle> post_batch(Range &&items, typename Clock::duration slack = {}) {
+        auto base = now();
+        std::vector<dispatch_handle> handles;
+        batch_.clear();
+        for(auto &&item : items) {
+            message_t *msg;
+            if constexpr(std::is_rvalue_reference<Range &&>::value) {
+                msg = acquire(std::move(std::get<0>(item)));
+            } else {
+                msg = acquire(std::get<0>(item));
+            }
+            msg->when = base + std::get<1>(item);
+            msg->latest = msg->when + slack;
+            assert(!msg->in_use);
+            msg->in_use = true;
+            handles.push_back(msg_pool_.handle(msg));
+            batch_.push_back(msg);
+        }
+        std::stable_sort(batch_.begin(), batch_.end(), [](const message_t *a, const message_t *b) {
+            return a->when < b->when;
+        });
+        order_.insert_sorted(batch_.data(), batch_.data() + batch_.size(), [this](const dispatch_insert &info) {
+            stats_.on_insert(info, order_.size());
+        });
+        batch_.clear();
+        schedule_timer();
+        return handles;
     }
 
-    void get(std::function<void(T &&)> cb) {
+    /**
+     * Dispatch val every interval until removed, message is re-armed in place without returning to the pool
+     * callback gets a copy of val, message keeps the original
+     * @param interval - first dispatch is one interval from now
+     */
+    template <class Rep, class Period>
+    dispatch_handle post_periodic(T arg, const std::chrono::duration<Rep, Period> &interval,
+                                   dispatch_periodic policy = dispatch_periodic::fixed_rate_catch_up,
+                                   typename Clock::duration slack = {}) {
+        static_assert(std::is_copy_constructible<T>::value, "periodic message requires copyable value");
+        assert(interval > interval.zero());
+        auto *msg = acquire(std::move(arg));
+        msg->interval = std::chrono::duration_cast<typename Clock::duration>(interval);
+        msg->policy = policy;
+        msg->when = now() + msg->interval;
+        msg->latest = msg->when + slack;
+        enqueue(msg);
+        schedule_timer();
+        return msg_pool_.handle(msg);
+    }
+
+    /**
+     * Remove pending message, periodic message can be removed also from its own callback
+     * @return false when handle is stale (message was dispatched or removed), queue is not touched
+     */
+    bool remove(const dispatch_handle &h) {
+        auto *msg = msg_pool_.find(h);
+        if(msg == nullptr || (!msg->in_use && !msg->firing)) {
+            return false;
+        }
+        remove(msg);
+        return true;
+    }
+
+    void remove(message_t* msg) {
+        if(msg->firing) {
+            msg->interval = {};
+            return;
+        }
+        assert(msg->in_use);
+        order_.erase(msg);
+        msg->in_use = false;
+        stats_.on_remove(order_.size());
+        msg_pool_.put(msg);
+        schedule_timer();
+    }
+
+    /**
+     * Callbacks of get/get_all_due/clear are taken by template and called directly so lambda is inlined,
+     * callback accepting T&& gets the value moved out, otherwise it is called with const T&,
+     * exception of the callback drops its message and re-arms the timer
+     * @return true when due message was dispatched
+     */
+    template <class F>
+    bool get(F &&cb) {
         auto *msg = dequeue();
         if(msg != nullptr) {
-            cb(std::move(msg->val));
-            msg_pool_.put(msg);
-            schedule_timer();
+            batch_guard batch(*this);
+            batch.firing = msg;
+            auto done = fire(msg, cb);
+            batch.firing = nullptr;
+            if(done) {
+                batch.done(msg);
+            }
+            return true;
         }
+        return false;
     }
 
-    void clear(const std::function<void(dispatch_message<T>*)>& cb) {
-        dispatch_message<T>* msg;
+    /**
+     * Dispatch every message due at the time of the call, clock is read once and timer re-armed once
+     * messages posted from the callback are not dispatched in this batch even when already due,
+     * batch ends at the first of them so due messages ordered behind it are left for the next call,
+     * periodic message behind schedule is dispatched repeatedly with fixed_rate_catch_up,
+     * exception of the callback ends the batch, its message is dropped and the timer re-armed
+     * @param max - maximum number of dispatched messages, rest is left for the next call
+     * @return number of dispatched messages
+     */
+    template <class F>
+    std::size_t get_all_due(F &&cb, std::size_t max = std::numeric_limits<std::size_t>::max()) {
+        auto now = Clock::now();
+        auto last_when = armed_head_;
+        std::size_t count = 0;
+        batch_guard batch(*this);
+        while(count < max) {
+            auto *msg = order_.peek_due(now);
+            // message posted by callback of this batch stays for the next call, queue due before it too
+            if(msg == nullptr || msg->batch == batch_id_) {
+                break;
+            }
+            order_.erase(msg);
+            assert(msg->in_use);
+            msg->in_use = false;
+            stats_.on_dispatch(now - msg->when, order_.size());
+            // deadline up to the armed bound got no wakeup of its own only because of slack
+            if(last_when < msg->when && armed_head_ < msg->when && msg->when <= armed_bound_) {
+                ++wakeups_saved_;
+            }
+            last_when = msg->when;
+            ++count;
+            batch.firing = msg;
+            auto done = fire(msg, cb);
+            batch.firing = nullptr;
+            if(done) {
+                batch.done(msg);
+            }
+        }
+        return count;
+    }
+
+    template <class F>
+    void clear(F &&cb) {
+        message_t* msg;
         while((msg = dequeue_head()) != nullptr) {
             cb(msg);
-            delete msg;
+            msg_pool_.destroy(msg);
         }
         MKS_ASSERT(empty());
     }
 
+    /**
+     * Pre-allocate messages for n posts, see dispatch_pool::reserve
+     */
+    void reserve(std::size_t n) {
+        msg_pool_.reserve(n);
+    }
+
+    /**
+     * Limit of idle messages kept for reuse
+     */
+    void set_pool_limit(std::size_t n) {
+        msg_pool_.set_max_size(n);
+    }
+
+    /**
+     * Release idle messages and empty slabs of the pool
+     */
+    void trim() {
+        msg_pool_.trim();
+    }
+
+    /**
+     * Instrumentation, see dispatch_stats.h
+     */
+    const Stats &stats() const {
+        return stats_;
+    }
+
+    /**
+     * Distinct deadlines dispatched by get_all_due() in the wakeup of an earlier one because of slack,
+     * deadlines batched only because the wakeup came late are not counted
+     */
+    std::size_t wakeups_saved() const {
+        return wakeups_saved_;
+    }
+
     void on_timer(std::function<void(dispatch_time_t)> cb) {
         run_timer_cb_ = std::move(cb);
     }
 
     std::size_t size() const {
-        return size_;
+        return order_.size();
     }
 
     bool empty() const {
@@ -360,5 +1076,7 @@ public:
     }
 };
 
+template <typename T, typename Backend = dispatch_list>
+using instrumented_dispatch_queue = dispatch_queue<T, Backend, dispatch_clock, dispatch_stats>;
 
 #endif // MKS_DISPATCH_QUEUE_H
@@ -0,0 +1,305 @@
+#ifndef MKS_DISPATCH_QUEUE_MPSC_H
+#define MKS_DISPATCH_QUEUE_MPSC_H
+
+/*
+ * Multi producer front end of dispatch_queue
+ *
+ * post_*()/cancel() can be called from any thread without lock, requests are pushed to intrusive atomic
+ * stacks (inbox and cancel box) and owning thread merges them into the ordered dispatch_queue in batches
+ * before it computes its next deadline (merge() / get())
+ *
+ * wakeup callback is called by producer only when its message became the earliest deadline known to the owner,
+ * it should wake the owning loop (Pipe::notify()), other posts are picked up on the next timer expiration
+ *
+ * node is dispatch_message itself, allocated by producer with new and linked into the inbox and then
+ * into the order of dispatch_queue without copying (see dispatch_queue::post_message), so one post
+ * is one allocation, handle keeps node alive so cancel() of already dispatched message is a no-op
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
+
+#include "dispatch_queue.h"
+
+template <class T, class Clock>
+struct dispatch_mpsc_node : dispatch_message<T, Clock> {
+    enum : uint8_t { pending, fired, cancelled };
+
+    // handle + queue
+    std::atomic<uint32_t> refs{2};
+    std::atomic<uint8_t> state{pending};
+    dispatch_mpsc_node<T, Clock> *inbox_next = nullptr;
+    dispatch_mpsc_node<T, Clock> *cancel_next = nullptr;
+
+    dispatch_mpsc_node(T &&val, typename Clock::time_point when) : dispatch_message<T, Clock>(std::move(val)) {
+        this->when = when;
+        this->latest = when;
+    }
+
+    void release() {
+        if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+};
+
+template <class T, class Clock = dispatch_clock>
+class dispatch_mpsc_handle {
+    using node_t = dispatch_mpsc_node<T, Clock>;
+
+    node_t *node_ = nullptr;
+
+    template <typename, typename, typename>
+    friend class dispatch_queue_mpsc;
+
+    explicit dispatch_mpsc_handle(node_t *node) : node_(node) {}
+
+public:
+    dispatch_mpsc_handle() = default;
+
+    dispatch_mpsc_handle(const dispatch_mpsc_handle &other) : node_(other.node_) {
+        if(node_ != nullptr) {
+            node_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    dispatch_mpsc_handle(dispatch_mpsc_handle &&other) noexcept : node_(other.node_) {
+        other.node_ = nullptr;
+    }
+
+    dispatch_mpsc_handle &operator=(dispatch_mpsc_handle other) noexcept {
+        std::swap(node_, other.node_);
+        return *this;
+    }
+
+    ~dispatch_mpsc_handle() {
+        if(node_ != nullptr) {
+            node_->release();
+        }
+    }
+
+    /**
+     * @return true while message is neither dispatched nor cancelled
+     */
+    bool pending() const {
+        return node_ != nullptr && node_->state.load(std::memory_order_acquire) == node_t::pending;
+    }
+
+    explicit operator bool() const {
+        return node_ != nullptr;
+    }
+};
+
+template <typename T, typename Backend = dispatch_list, typename Clock = dispatch_clock>
+class dispatch_queue_mpsc {
+public:
+    using handle = dispatch_mpsc_handle<T, Clock>;
+
+private:
+    using node_t = dispatch_mpsc_node<T, Clock>;
+    using rep_t = typename Clock::rep;
+
+    static constexpr rep_t idle = std::numeric_limits<rep_t>::max();
+
+    // producers
+    alignas(64) std::atomic<node_t *> inbox_{nullptr};
+    std::atomic<node_t *> cancel_box_{nullptr};
+    // earliest deadline owner will wake up for, published by owner
+    alignas(64) std::atomic<rep_t> earliest_{idle};
+    std::function<void()> wakeup_cb_;
+
+    // owner, holds only nodes posted by post_message()
+    alignas(64) dispatch_queue<T, Backend, Clock> queue_;
+    std::function<void(dispatch_time_t)> run_timer_cb_;
+
+    template <class Duration>
+    static rep_t to_rep(const std::chrono::time_point<Clock, Duration> &when) {
+        return std::chrono::duration_cast<typename Clock::duration>(when.time_since_epoch()).count();
+    }
+
+    void publish_idle() {
+        if(queue_.empty()) {
+            earliest_.store(idle, std::memory_order_seq_cst);
+        }
+    }
+
+    static void push(std::atomic<node_t *> &stack, node_t *node, node_t *node_t::*link) {
+        auto *head = stack.load(std::memory_order_relaxed);
+        do {
+            node->*link = head;
+        } while(!stack.compare_exchange_weak(head, node, std::memory_order_seq_cst, std::memory_order_relaxed));
+    }
+
+    static node_t *reverse(node_t *node, node_t *node_t::*link) {
+        node_t *ret = nullptr;
+        while(node != nullptr) {
+            auto *next = node->*link;
+            node->*link = ret;
+            ret = node;
+            node = next;
+        }
+        return ret;
+    }
+
+    handle post(node_t *node) {
+        auto when = to_rep(node->when);
+        push(inbox_, node, &node_t::inbox_next);
+        // wake owner only when this message is the new earliest deadline
+        auto current = earliest_.load(std::memory_order_seq_cst);
+        while(when < current) {
+            if(earliest_.compare_exchange_weak(current, when, std::memory_order_seq_cst)) {
+                if(wakeup_cb_) {
+                    wakeup_cb_();
+                }
+                break;
+            }
+        }
+        return handle(node);
+    }
+
+    std::size_t merge_once() {
+        std::size_t merged = 0;
+        // cancels first, every cancelled node was pushed to the inbox before it was cancelled
+        auto *cancels = cancel_box_.exchange(nullptr, std::memory_order_acquire);
+        auto *inbox = reverse(inbox_.exchange(nullptr, std::memory_order_acquire), &node_t::inbox_next);
+        while(inbox != nullptr) {
+            auto *next = inbox->inbox_next;
+            if(inbox->state.load(std::memory_order_acquire) == node_t::pending) {
+                queue_.post_message(inbox);
+            }
+            inbox = next;
+            ++merged;
+        }
+        while(cancels != nullptr) {
+            auto *next = cancels->cancel_next;
+            // not linked when message was taken for dispatch or cancelled before merge
+            if(cancels->in_use) {
+                queue_.remove_message(cancels);
+            }
+            cancels->release();
+            cancels = next;
+        }
+        return merged;
+    }
+
+public:
+    dispatch_queue_mpsc() {
+        queue_.on_timer([this](dispatch_time_t time) {
+            earliest_.store(to_rep(Clock::now() + time), std::memory_order_seq_cst);
+            if(run_timer_cb_) {
+                run_timer_cb_(time);
+            }
+        });
+    }
+
+    dispatch_queue_mpsc(const dispatch_queue_mpsc &) = delete;
+    dispatch_queue_mpsc &operator=(const dispatch_queue_mpsc &) = delete;
+
+    ~dispatch_queue_mpsc() {
+        merge();
+        while(auto *msg = queue_.take_message()) {
+            static_cast<node_t *>(msg)->release();
+        }
+    }
+
+    /**
+     * Any thread
+     */
+    template <class Rep, class Period>
+    handle post_delayed(T arg, const std::chrono::duration<Rep, Period> &time) {
+        return post(new node_t(std::move(arg), Clock::now() + time));
+    }
+
+    template <class Duration>
+    handle post_at(T arg, const std::chrono::time_point<Clock, Duration> &time) {
+        return post(new node_t(std::move(arg), time));
+    }
+
+    /**
+     * Any thread
+     * @return false when message was already dispatched or cancelled
+     */
+    bool cancel(const handle &h) {
+        auto *node = h.node_;
+        if(node == nullptr) {
+            return false;
+        }
+        auto expected = static_cast<uint8_t>(node_t::pending);
+        if(!node->state.compare_exchange_strong(expected, node_t::cancelled, std::memory_order_acq_rel)) {
+            return false;
+        }
+        push(cancel_box_, node, &node_t::cancel_next);
+        return true;
+    }
+
+    /**
+     * Set before producers start, called from producer thread
+     */
+    void on_wakeup(std::function<void()> cb) {
+        wakeup_cb_ = std::move(cb);
+    }
+
+    /**
+     * Owner thread, same meaning as dispatch_queue::on_timer
+     */
+    void on_timer(std::function<void(dispatch_time_t)> cb) {
+        run_timer_cb_ = std::move(cb);
+    }
+
+    /**
+     * Owner thread, move everything posted/cancelled so far into the ordered queue
+     * @return number of merged posts
+     */
+    std::size_t merge() {
+        std::size_t merged = 0;
+        for(;;) {
+            merged += merge_once();
+            publish_idle();
+            // producer either saw the published deadline or we see its push
+            if(inbox_.load(std::memory_order_seq_cst) == nullptr &&
+               cancel_box_.load(std::memory_order_seq_cst) == nullptr) {
+                break;
+            }
+        }
+        return merged;
+    }
+
+    /**
+     * Owner thread, merge and dispatch single due message
+     * @return true when message was dispatched
+     */
+    template <class F>
+    bool get(F &&cb) {
+        merge();
+        for(;;) {
+            auto *node = static_cast<node_t *>(queue_.get_message());
+            if(node == nullptr) {
+                publish_idle();
+                return false;
+            }
+            auto expected = static_cast<uint8_t>(node_t::pending);
+            if(node->state.compare_exchange_strong(expected, node_t::fired, std::memory_order_acq_rel)) {
+                cb(std::move(node->val));
+                node->release();
+                publish_idle();
+                return true;
+            }
+            // cancelled in between, reference is released by cancel box on next merge
+        }
+    }
+
+    /**
+     * Owner thread, messages merged into the ordered queue
+     */
+    std::size_t size() const {
+        return queue_.size();
+    }
+
+    bool empty() const {
+        return queue_.empty();
+    }
+};
+
+#endif // MKS_DISPATCH_QUEUE_MPSC_H
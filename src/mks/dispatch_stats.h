@@ -0,0 +1,148 @@
+#ifndef MKS_DISPATCH_STATS_H
+#define MKS_DISPATCH_STATS_H
+
+/*
+ * Instrumentation policies for dispatch_queue, same shape as queue_stats.h policies of queue_buffer
+ *
+ * dispatch_no_stats - default, every hook is empty and inlined away
+ * dispatch_stats    - lateness of dispatched messages (dispatch time - when), pending count,
+ *                     where backend inserted new messages and how far it walked, dispatch_pool hit rate
+ *                     values are relaxed atomics so snapshot() can be read from other thread
+ *
+ * dispatch_queue<int, dispatch_list, dispatch_clock, dispatch_stats> queue;
+ * auto s = queue.stats().snapshot();
+ * MKS_LOG_D("pending={} late p99={}ns", s.pending, s.lateness.percentile(0.99));
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "queue_stats.h"
+
+/**
+ * Returned by insert() of ordering backends
+ */
+struct dispatch_insert {
+    enum where_t : uint8_t { head, tail, middle };
+
+    where_t where = tail;
+    // messages walked over (list) or levels sifted (heap)
+    std::size_t steps = 0;
+};
+
+struct dispatch_stats_snapshot {
+    std::uint64_t pending = 0;
+    std::uint64_t posted = 0;
+    std::uint64_t dispatched = 0;
+    std::uint64_t removed = 0;
+    std::uint64_t insert_head = 0;
+    std::uint64_t insert_tail = 0;
+    std::uint64_t insert_middle = 0;
+    std::uint64_t insert_steps = 0;
+    std::uint64_t pool_hits = 0;
+    std::uint64_t pool_misses = 0;
+    // dispatch time - when
+    mks::histogram_snapshot lateness;
+
+    double pool_hit_rate() const {
+        auto total = pool_hits + pool_misses;
+        return total == 0 ? 0.0 : static_cast<double>(pool_hits) / static_cast<double>(total);
+    }
+
+    /**
+     * Average walk of insert that was not at head or tail
+     */
+    double mean_insert_steps() const {
+        return insert_middle == 0 ? 0.0 : static_cast<double>(insert_steps) / static_cast<double>(insert_middle);
+    }
+};
+
+/**
+ * Default policy, compiled out completely
+ */
+struct dispatch_no_stats {
+    void on_insert(const dispatch_insert &, std::size_t) {}
+    void on_pool(bool) {}
+    template <class Duration>
+    void on_dispatch(const Duration &, std::size_t) {}
+    void on_remove(std::size_t) {}
+
+    dispatch_stats_snapshot snapshot() const {
+        return dispatch_stats_snapshot{};
+    }
+};
+
+/**
+ * Recording policy, hooks are called by the queue on its owning thread
+ */
+class dispatch_stats {
+    std::atomic<std::uint64_t> pending_{0};
+    std::atomic<std::uint64_t> posted_{0};
+    std::atomic<std::uint64_t> dispatched_{0};
+    std::atomic<std::uint64_t> removed_{0};
+    std::atomic<std::uint64_t> insert_head_{0};
+    std::atomic<std::uint64_t> insert_tail_{0};
+    std::atomic<std::uint64_t> insert_middle_{0};
+    std::atomic<std::uint64_t> insert_steps_{0};
+    std::atomic<std::uint64_t> pool_hits_{0};
+    std::atomic<std::uint64_t> pool_misses_{0};
+    mks::latency_histogram lateness_;
+
+    // single writer, plain load + store is enough
+    static void inc(std::atomic<std::uint64_t> &counter, std::uint64_t n = 1) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+public:
+    void on_insert(const dispatch_insert &info, std::size_t pending) {
+        inc(posted_);
+        switch(info.where) {
+        case dispatch_insert::head:
+            inc(insert_head_);
+            break;
+        case dispatch_insert::tail:
+            inc(insert_tail_);
+            break;
+        case dispatch_insert::middle:
+            inc(insert_middle_);
+            inc(insert_steps_, info.steps);
+            break;
+        }
+        pending_.store(pending, std::memory_order_relaxed);
+    }
+
+    void on_pool(bool hit) {
+        inc(hit ? pool_hits_ : pool_misses_);
+    }
+
+    template <class Duration>
+    void on_dispatch(const Duration &lateness, std::size_t pending) {
+        inc(dispatched_);
+        lateness_.record(lateness);
+        pending_.store(pending, std::memory_order_relaxed);
+    }
+
+    void on_remove(std::size_t pending) {
+        inc(removed_);
+        pending_.store(pending, std::memory_order_relaxed);
+    }
+
+    dispatch_stats_snapshot snapshot() const {
+        dispatch_stats_snapshot ret;
+        ret.pending = pending_.load(std::memory_order_relaxed);
+        ret.posted = posted_.load(std::memory_order_relaxed);
+        ret.dispatched = dispatched_.load(std::memory_order_relaxed);
+        ret.removed = removed_.load(std::memory_order_relaxed);
+        ret.insert_head = insert_head_.load(std::memory_order_relaxed);
+        ret.insert_tail = insert_tail_.load(std::memory_order_relaxed);
+        ret.insert_middle = insert_middle_.load(std::memory_order_relaxed);
+        ret.insert_steps = insert_steps_.load(std::memory_order_relaxed);
+        ret.pool_hits = pool_hits_.load(std::memory_order_relaxed);
+        ret.pool_misses = pool_misses_.load(std::memory_order_relaxed);
+        ret.lateness = lateness_.snapshot();
+        return ret;
+    }
+};
+
+#endif // MKS_DISPATCH_STATS_H
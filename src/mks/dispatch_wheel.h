@@ -0,0 +1,357 @@
+#ifndef MKS_DISPATCH_WHEEL_H
+#define MKS_DISPATCH_WHEEL_H
+
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "dispatch_stats.h"
+
+/*
+ * Hierarchical timing wheel ordering backend for dispatch_queue
+ *
+ * Levels wheels with 2^SlotBits slots each, level 0 slot is one Tick, level n slot covers 2^(n*SlotBits) ticks
+ * insert/erase are O(1), when wheel reaches the start of a higher level slot its messages are cascaded
+ * to the lower levels, deadlines are rounded up to the tick so message is never dispatched before its time
+ * messages due in the same tick are dispatched in insertion order, not strictly by their deadline
+ * slack of the messages is ignored, tick itself is the coalescing window
+ *
+ * default 1ms tick, 4 levels of 256 slots covers ~49 days, later deadlines are parked in the last level
+ */
+
+template <typename M, typename Tick, std::size_t Levels, std::size_t SlotBits>
+class dispatch_wheel_order {
+    static_assert(Levels > 0 && SlotBits > 0 && Levels * SlotBits < 64, "wheel range must fit into 64 bit tick");
+
+public:
+    using time_point = typename M::time_point;
+
+private:
+    static constexpr std::size_t slots = std::size_t(1) << SlotBits;
+    static constexpr std::uint64_t slot_mask = slots - 1;
+    static constexpr std::size_t words = (slots + 63) / 64;
+    static constexpr std::size_t ready_bucket = Levels * slots;
+    static constexpr std::uint64_t range = std::uint64_t(1) << (Levels * SlotBits);
+    static constexpr std::size_t none = std::numeric_limits<std::size_t>::max();
+
+    struct bucket {
+        M *head = nullptr;
+        M *tail = nullptr;
+    };
+
+    std::vector<bucket> buckets_ = std::vector<bucket>(Levels * slots + 1);
+    std::uint64_t occupied_[Levels][words] = {};
+    std::uint64_t current_ = 0;
+    time_point origin_ = M::clock::now();
+    std::size_t size_ = 0;
+    // messages in levels, without ready bucket
+    std::size_t wheel_size_ = 0;
+
+    static std::size_t ctz(std::uint64_t v) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64(&index, v);
+        return index;
+#else
+        return static_cast<std::size_t>(__builtin_ctzll(v));
+#endif
+    }
+
+    std::uint64_t tick_ceil(const time_point &when) const {
+        if(when <= origin_) {
+            return 0;
+        }
+        auto diff = when - origin_;
+        auto ticks = std::chrono::duration_cast<Tick>(diff);
+        if(ticks < diff) {
+            ++ticks;
+        }
+        return static_cast<std::uint64_t>(ticks.count());
+    }
+
+    std::uint64_t tick_floor(const time_point &now) const {
+        if(now <= origin_) {
+            return 0;
+        }
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<Tick>(now - origin_).count());
+    }
+
+    time_point time_of(std::uint64_t tick) const {
+        return origin_ + std::chrono::duration_cast<typename time_point::duration>(Tick(tick));
+    }
+
+    // occupancy bit of the slot within its level, index is level * slots + slot
+    void occupy(std::size_t index) {
+        auto slot = index % slots;
+        occupied_[index / slots][slot / 64] |= std::uint64_t(1) << (slot % 64);
+    }
+
+    void vacate(std::size_t index) {
+        auto slot = index % slots;
+        occupied_[index / slots][slot / 64] &= ~(std::uint64_t(1) << (slot % 64));
+    }
+
+    void link(std::size_t index, M *msg) {
+        auto &b = buckets_[index];
+        msg->index = index;
+        msg->next_message = nullptr;
+        msg->prev_message = b.tail;
+        if(b.tail != nullptr) {
+            b.tail->next_message = msg;
+        } else {
+            b.head = msg;
+            if(index != ready_bucket) {
+                occupy(index);
+            }
+        }
+        b.tail = msg;
+        if(index != ready_bucket) {
+            ++wheel_size_;
+        }
+    }
+
+    void unlink(M *msg) {
+        auto index = msg->index;
+        auto &b = buckets_[index];
+        auto *prev = msg->prev_message;
+        auto *next = msg->next_message;
+        if(prev != nullptr) {
+            prev->next_message = next;
+        } else {
+            b.head = next;
+        }
+        if(next != nullptr) {
+            next->prev_message = prev;
+        } else {
+            b.tail = prev;
+        }
+        msg->prev_message = nullptr;
+        msg->next_message = nullptr;
+        if(index != ready_bucket) {
+            if(b.head == nullptr) {
+                vacate(index);
+            }
+            --wheel_size_;
+        }
+    }
+
+    void place(M *msg) {
+        auto tick = tick_ceil(msg->when);
+        if(tick <= current_) {
+            link(ready_bucket, msg);
+            return;
+        }
+        auto delta = tick - current_;
+        if(delta >= range) {
+            // parked in the last level, placed again during cascade
+            tick = current_ + range - 1;
+            delta = range - 1;
+        }
+        std::size_t level = 0;
+        while(delta >= (std::uint64_t(1) << ((level + 1) * SlotBits))) {
+            ++level;
+        }
+        auto slot = static_cast<std::size_t>((tick >> (level * SlotBits)) & slot_mask);
+        link(level * slots + slot, msg);
+    }
+
+    /**
+     * First occupied slot of the level in cyclic order starting at 'from'
+     */
+    std::size_t find_slot(std::size_t level, std::size_t from) const {
+        for(std::size_t n = 0; n <= words; ++n) {
+            auto w = ((from / 64) + n) % words;
+            auto bits = occupied_[level][w];
+            if(n == 0) {
+                bits &= ~std::uint64_t(0) << (from % 64);
+            } else if(n == words) {
+                bits &= (from % 64) == 0 ? 0 : ~(~std::uint64_t(0) << (from % 64));
+            }
+            if(bits != 0) {
+                return w * 64 + ctz(bits);
+            }
+        }
+        return none;
+    }
+
+    /**
+     * Tick when slot of the level is expired (level 0) or cascaded (higher levels)
+     */
+    std::uint64_t slot_tick(std::size_t level, std::size_t slot) const {
+        auto shift = level * SlotBits;
+        auto k = ((current_ >> shift) & ~slot_mask) | slot;
+        if((k << shift) <= current_) {
+            k += slots;
+        }
+        return k << shift;
+    }
+
+    void move_bucket(std::size_t index) {
+        auto *msg = buckets_[index].head;
+        buckets_[index].head = nullptr;
+        buckets_[index].tail = nullptr;
+        vacate(index);
+        while(msg != nullptr) {
+            auto *next = msg->next_message;
+            --wheel_size_;
+            place(msg);
+            msg = next;
+        }
+    }
+
+    void cascade() {
+        for(std::size_t level = 1; level < Levels; ++level) {
+            auto slot = static_cast<std::size_t>((current_ >> (level * SlotBits)) & slot_mask);
+            move_bucket(level * slots + slot);
+            if(slot != 0) {
+                break;
+            }
+        }
+    }
+
+    void advance(std::uint64_t target) {
+        while(current_ < target) {
+            if(wheel_size_ == 0) {
+                current_ = target;
+                return;
+            }
+            // jump to next occupied level 0 slot in this rotation or to the rotation boundary
+            auto boundary = (current_ | slot_mask) + 1;
+            auto step = boundary;
+            auto from = static_cast<std::size_t>(current_ & slot_mask) + 1;
+            if(from < slots) {
+                auto slot = find_slot(0, from);
+                if(slot != none && slot >= from) {
+                    step = (current_ & ~slot_mask) | slot;
+                }
+            }
+            if(step > target) {
+                current_ = target;
+                return;
+            }
+            current_ = step;
+            if((current_ & slot_mask) == 0) {
+                cascade();
+            }
+            move_bucket(static_cast<std::size_t>(current_ & slot_mask));
+        }
+    }
+
+public:
+    dispatch_wheel_order() = default;
+    dispatch_wheel_order(const dispatch_wheel_order &) = delete;
+    dispatch_wheel_order &operator=(const dispatch_wheel_order &) = delete;
+
+    dispatch_insert insert(M *msg) {
+        place(msg);
+        ++size_;
+        return dispatch_insert{};
+    }
+
+    template <class F>
+    void insert_sorted(M *const *first, M *const *last, F &&on_insert) {
+        for(; first != last; ++first) {
+            on_insert(insert(*first));
+        }
+    }
+
+    void erase(M *msg) {
+        unlink(msg);
+        assert(size_ > 0);
+        --size_;
+    }
+
+    M *pop_due(const time_point &now) {
+        if(size_ == 0) {
+            return nullptr;
+        }
+        advance(tick_floor(now));
+        auto *msg = buckets_[ready_bucket].head;
+        if(msg != nullptr) {
+            erase(msg);
+        }
+        return msg;
+    }
+
+    /**
+     * Message pop_due() would return, left in the order
+     */
+    M *peek_due(const time_point &now) {
+        if(size_ == 0) {
+            return nullptr;
+        }
+        advance(tick_floor(now));
+        return buckets_[ready_bucket].head;
+    }
+
+    M *pop_any() {
+        auto *msg = buckets_[ready_bucket].head;
+        for(std::size_t level = 0; msg == nullptr && level < Levels; ++level) {
+            auto slot = find_slot(level, 0);
+            if(slot != none) {
+                msg = buckets_[level * slots + slot].head;
+            }
+        }
+        if(msg != nullptr) {
+            erase(msg);
+        }
+        return msg;
+    }
+
+    /**
+     * Time of the next expiration or cascade, wakeup at cascade can be spurious
+     */
+    bool next_deadline(time_point &when) const {
+        if(size_ == 0) {
+            return false;
+        }
+        if(buckets_[ready_bucket].head != nullptr) {
+            when = time_of(current_);
+            return true;
+        }
+        auto next = std::numeric_limits<std::uint64_t>::max();
+        for(std::size_t level = 0; level < Levels; ++level) {
+            auto from = static_cast<std::size_t>(((current_ >> (level * SlotBits)) + 1) & slot_mask);
+            auto slot = find_slot(level, from);
+            if(slot != none) {
+                auto tick = slot_tick(level, slot);
+                if(tick < next) {
+                    next = tick;
+                }
+            }
+        }
+        when = time_of(next);
+        return true;
+    }
+
+    /**
+     * Slack is not used, expirations are already grouped by the tick
+     */
+    bool coalesced_deadline(time_point &when) const {
+        return next_deadline(when);
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+};
+
+/**
+ * Backend selector for dispatch_queue
+ * @tparam Tick - duration of one tick of level 0
+ * @tparam Levels - number of wheels
+ * @tparam SlotBits - log2 of slots per wheel
+ */
+template <typename Tick = std::chrono::milliseconds, std::size_t Levels = 4, std::size_t SlotBits = 8>
+struct dispatch_wheel {
+    template <typename M>
+    using order = dispatch_wheel_order<M, Tick, Levels, SlotBits>;
+};
+
+#endif // MKS_DISPATCH_WHEEL_H
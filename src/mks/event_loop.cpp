@@ -0,0 +1,199 @@
+#include "event_loop.h"
+
+#ifdef __linux__
+
+#include <sys/timerfd.h>
+
+using namespace mks;
+
+static constexpr std::size_t initial_events = 64;
+
+event_loop::~event_loop() {
+    if(!timers_.empty()) {
+        timers_.clear([](dispatch_message<task> *) {});
+    }
+    watchers_.clear();
+    removed_.clear();
+    wakeup_.close();
+    if(timer_fd_ >= 0) {
+        ::close(timer_fd_);
+    }
+    if(epoll_fd_ >= 0) {
+        ::close(epoll_fd_);
+    }
+}
+
+bool event_loop::init() {
+    MKS_ASSERT(epoll_fd_ < 0);
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd_ < 0) {
+        MKS_LOG_E("epoll_create1 failed errno={}", errno);
+        return false;
+    }
+    timer_fd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(timer_fd_ < 0) {
+        MKS_LOG_E("timerfd_create failed errno={}", errno);
+        return false;
+    }
+    wakeup_.set_callback([this]() {
+        process_tasks();
+    });
+    if(!wakeup_.init()) {
+        MKS_LOG_E("wakeup pipe init failed");
+        return false;
+    }
+    timers_.on_timer([this](dispatch_time_t time) {
+        arm_timer(time);
+    });
+    events_.resize(initial_events);
+
+    if(!add_fd(wakeup_.wfd(), EPOLLIN, [this](uint32_t) { wakeup_.process(); })) {
+        return false;
+    }
+    if(!add_fd(timer_fd_, EPOLLIN, [this](uint32_t) { process_timers(); })) {
+        return false;
+    }
+    return true;
+}
+
+void event_loop::run() {
+    thread_id_.store(std::this_thread::get_id());
+    running_.store(true);
+    while(running_.load(std::memory_order_relaxed)) {
+        if(run_once(-1) < 0 && errno != EINTR) {
+            MKS_LOG_E("epoll_wait failed errno={}", errno);
+            break;
+        }
+    }
+    thread_id_.store(std::thread::id{});
+}
+
+int event_loop::run_once(int timeout_ms) {
+    MKS_ASSERT(epoll_fd_ >= 0);
+    auto n = ::epoll_wait(epoll_fd_, events_.data(), static_cast<int>(events_.size()), timeout_ms);
+    if(n < 0) {
+        return -1;
+    }
+    for(int i = 0; i != n; ++i) {
+        auto *w = static_cast<watcher *>(events_[i].data.ptr);
+        // removed by one of the previous callbacks in this batch
+        if(w->fd < 0) {
+            continue;
+        }
+        w->cb(events_[i].events);
+    }
+    removed_.clear();
+    if(static_cast<std::size_t>(n) == events_.size()) {
+        // more events are probably waiting, next batch can take them all
+        events_.resize(events_.size() * 2);
+    }
+    return n;
+}
+
+void event_loop::stop() {
+    running_.store(false);
+    wakeup_.notify();
+}
+
+bool event_loop::ctl(int op, watcher *w, uint32_t events) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.ptr = w;
+    if(::epoll_ctl(epoll_fd_, op, w->fd, &ev) < 0) {
+        MKS_LOG_E("epoll_ctl op={} fd={} failed errno={}", op, w->fd, errno);
+        return false;
+    }
+    return true;
+}
+
+bool event_loop::add_fd(int fd, uint32_t events, fd_callback cb, bool edge_triggered) {
+    MKS_ASSERT(watchers_.find(fd) == watchers_.end());
+    auto w = std::make_unique<watcher>();
+    w->fd = fd;
+    w->cb = std::move(cb);
+    if(!ctl(EPOLL_CTL_ADD, w.get(), edge_triggered ? events | EPOLLET : events)) {
+        return false;
+    }
+    watchers_.emplace(fd, std::move(w));
+    return true;
+}
+
+bool event_loop::modify_fd(int fd, uint32_t events, bool edge_triggered) {
+    auto it = watchers_.find(fd);
+    if(it == watchers_.end()) {
+        return false;
+    }
+    return ctl(EPOLL_CTL_MOD, it->second.get(), edge_triggered ? events | EPOLLET : events);
+}
+
+bool event_loop::remove_fd(int fd) {
+    auto it = watchers_.find(fd);
+    if(it == watchers_.end()) {
+        return false;
+    }
+    auto ret = ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr) == 0;
+    it->second->fd = -1;
+    removed_.push_back(std::move(it->second));
+    watchers_.erase(it);
+    return ret;
+}
+
+void event_loop::run_in_loop(task cb) {
+    if(in_loop_thread()) {
+        cb();
+        return;
+    }
+    queue_in_loop(std::move(cb));
+}
+
+void event_loop::queue_in_loop(task cb) {
+    {
+        std::lock_guard<std::mutex> ll{tasks_mtx_};
+        tasks_.push_back(std::move(cb));
+    }
+    // coalesced, only first task after last process() issues syscall
+    wakeup_.notify();
+}
+
+void event_loop::cancel(timer_id id) {
+    timers_.remove(id);
+}
+
+bool event_loop::in_loop_thread() const {
+    return thread_id_.load() == std::this_thread::get_id();
+}
+
+void event_loop::arm_timer(dispatch_time_t time) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+    // zero would disarm the timer
+    if(ns <= 0) {
+        ns = 1;
+    }
+    itimerspec spec{};
+    spec.it_value.tv_sec = static_cast<time_t>(ns / 1000000000LL);
+    spec.it_value.tv_nsec = static_cast<long>(ns % 1000000000LL);
+    if(::timerfd_settime(timer_fd_, 0, &spec, nullptr) < 0) {
+        MKS_LOG_E("timerfd_settime failed errno={}", errno);
+    }
+}
+
+void event_loop::process_timers() {
+    uint64_t expirations;
+    while(::read(timer_fd_, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+    }
+    // one clock read and one timerfd re-arm for all expired timers
+    timers_.get_all_due([](task &&cb) { cb(); });
+}
+
+void event_loop::process_tasks() {
+    {
+        std::lock_guard<std::mutex> ll{tasks_mtx_};
+        running_tasks_.swap(tasks_);
+    }
+    for(auto &cb : running_tasks_) {
+        cb();
+    }
+    running_tasks_.clear();
+}
+
+#endif // __linux__
@@ -0,0 +1,150 @@
+#ifndef MKS_EVENT_LOOP_H
+#define MKS_EVENT_LOOP_H
+
+/*
+ * epoll based event loop (Linux only)
+ *
+ * - fd readiness watchers, level or edge triggered
+ * - timers from dispatch_queue driven by single timerfd
+ * - run_in_loop() from any thread, tasks are batched and loop is woken up by Pipe (eventfd)
+ * - all events returned by one epoll_wait are processed in one batch
+ *
+ * mks::event_loop loop;
+ * loop.init();
+ * loop.add_fd(fd, EPOLLIN, [](uint32_t events){ ... });
+ * loop.run_after(std::chrono::seconds(1), [](){ ... });
+ * std::thread th([&](){ loop.run(); });
+ * loop.run_in_loop([&](){ loop.stop(); });
+ */
+
+#ifdef __linux__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/epoll.h>
+
+#include "dispatch_queue.h"
+#include "pipe.h"
+
+namespace mks {
+
+class event_loop {
+public:
+    using fd_callback = std::function<void(uint32_t)>;
+    using task = std::function<void()>;
+    using timer_id = dispatch_handle;
+
+    event_loop() = default;
+    ~event_loop();
+
+    event_loop(const event_loop &) = delete;
+    event_loop &operator=(const event_loop &) = delete;
+
+    /**
+     * Create epoll, timerfd and wakeup pipe
+     * @return false when any of the descriptors can not be created
+     */
+    bool init();
+
+    /**
+     * Run loop on the calling thread until stop() is called
+     */
+    void run();
+
+    /**
+     * Wait for events at most timeout_ms (-1 = infinite) and process them
+     * @return number of processed events or -1 on epoll error
+     */
+    int run_once(int timeout_ms);
+
+    /**
+     * Thread safe, loop will return from run() after current batch
+     */
+    void stop();
+
+    /**
+     * Register fd readiness watcher, loop thread only
+     * @param events - EPOLLIN/EPOLLOUT/... without EPOLLET
+     * @param edge_triggered - adds EPOLLET
+     */
+    bool add_fd(int fd, uint32_t events, fd_callback cb, bool edge_triggered = false);
+    bool modify_fd(int fd, uint32_t events, bool edge_triggered = false);
+    bool remove_fd(int fd);
+
+    /**
+     * Thread safe, task is executed immediately when called from loop thread,
+     * otherwise it is queued and executed in next batch
+     */
+    void run_in_loop(task cb);
+
+    /**
+     * Thread safe, task is always queued
+     */
+    void queue_in_loop(task cb);
+
+    /**
+     * Timers, loop thread only (use run_in_loop to schedule from other threads)
+     */
+    template <class Rep, class Period>
+    timer_id run_after(const std::chrono::duration<Rep, Period> &time, task cb) {
+        return timers_.post_delayed(std::move(cb), time);
+    }
+
+    template <class Clock, class Duration>
+    timer_id run_at(const std::chrono::time_point<Clock, Duration> &time, task cb) {
+        return timers_.post_at(std::move(cb), time);
+    }
+
+    /**
+     * No-op when timer already fired or was cancelled
+     */
+    void cancel(timer_id id);
+
+    bool in_loop_thread() const;
+
+    std::size_t timers() const {
+        return timers_.size();
+    }
+
+private:
+    struct watcher {
+        int fd = -1;
+        fd_callback cb;
+    };
+
+    int epoll_fd_ = -1;
+    int timer_fd_ = -1;
+    std::atomic<bool> running_{false};
+    std::atomic<std::thread::id> thread_id_{};
+
+    Pipe wakeup_;
+    std::mutex tasks_mtx_;
+    std::vector<task> tasks_;
+    std::vector<task> running_tasks_;
+
+    dispatch_queue<task> timers_;
+
+    std::vector<epoll_event> events_;
+    std::unordered_map<int, std::unique_ptr<watcher>> watchers_;
+    // watchers removed during batch, event for them can still be in events_
+    std::vector<std::unique_ptr<watcher>> removed_;
+
+    bool ctl(int op, watcher *w, uint32_t events);
+    void arm_timer(dispatch_time_t time);
+    void process_timers();
+    void process_tasks();
+};
+
+} // namespace mks
+
+#endif // __linux__
+
+#endif // MKS_EVENT_LOOP_H
@@ -0,0 +1,202 @@
+#ifndef MKS_INTRUSIVE_QUEUE_H
+#define MKS_INTRUSIVE_QUEUE_H
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <mutex>
+#include <type_traits>
+
+/*
+ * Intrusive queues, element embeds its own link (derive from intrusive_queue_hook)
+ * queue never allocates and never copies elements, only pointers are relinked
+ * ownership stays with the caller (typically memory_pool), element can be in one queue at a time
+ *
+ * struct message : mks::intrusive_queue_hook { ... };
+ * mks::intrusive_mpsc_queue<message> q;
+ * q.push(pool.get());
+ */
+
+namespace mks {
+
+struct intrusive_queue_hook {
+    std::atomic<intrusive_queue_hook *> next_hook{nullptr};
+
+    intrusive_queue_hook() = default;
+    // link is never copied together with the payload
+    intrusive_queue_hook(const intrusive_queue_hook &) noexcept {}
+    intrusive_queue_hook &operator=(const intrusive_queue_hook &) noexcept { return *this; }
+};
+
+/**
+ * Blocking FIFO with the same semantics as queue_buffer, protected by mutex
+ * @tparam T - element type derived from intrusive_queue_hook
+ */
+template <typename T>
+class intrusive_queue_buffer {
+    static_assert(std::is_base_of<intrusive_queue_hook, T>::value, "T must derive from intrusive_queue_hook");
+
+    mutable std::mutex mu_;
+    std::condition_variable cond_;
+    intrusive_queue_hook *head_ = nullptr;
+    intrusive_queue_hook *tail_ = nullptr;
+    std::size_t size_ = 0;
+
+    static intrusive_queue_hook *next(intrusive_queue_hook *hook) {
+        return hook->next_hook.load(std::memory_order_relaxed);
+    }
+
+    T *pop() {
+        auto *hook = head_;
+        assert(hook != nullptr);
+        head_ = next(hook);
+        if(head_ == nullptr) {
+            tail_ = nullptr;
+        }
+        hook->next_hook.store(nullptr, std::memory_order_relaxed);
+        --size_;
+        return static_cast<T *>(hook);
+    }
+
+public:
+    intrusive_queue_buffer() = default;
+    intrusive_queue_buffer(const intrusive_queue_buffer &) = delete;
+    intrusive_queue_buffer &operator=(const intrusive_queue_buffer &) = delete;
+
+    void add(T *val) {
+        assert(val != nullptr);
+        intrusive_queue_hook *hook = val;
+        // new tail, element can come with a stale link from other queue
+        hook->next_hook.store(nullptr, std::memory_order_relaxed);
+        std::unique_lock<std::mutex> locker(mu_);
+        if(tail_ == nullptr) {
+            head_ = hook;
+        } else {
+            tail_->next_hook.store(hook, std::memory_order_relaxed);
+        }
+        tail_ = hook;
+        ++size_;
+        locker.unlock();
+        cond_.notify_one();
+    }
+
+    void add_first(T *val) {
+        assert(val != nullptr);
+        intrusive_queue_hook *hook = val;
+        // same as add(), element can come with a stale link from other queue
+        hook->next_hook.store(nullptr, std::memory_order_relaxed);
+        std::unique_lock<std::mutex> locker(mu_);
+        hook->next_hook.store(head_, std::memory_order_relaxed);
+        head_ = hook;
+        if(tail_ == nullptr) {
+            tail_ = hook;
+        }
+        ++size_;
+        locker.unlock();
+        cond_.notify_one();
+    }
+
+    T *remove() {
+        std::unique_lock<std::mutex> locker(mu_);
+        cond_.wait(locker, [this]() { return head_ != nullptr; });
+        return pop();
+    }
+
+    /**
+     * @return element or nullptr when queue is empty
+     */
+    T *try_remove() {
+        std::lock_guard<std::mutex> locker(mu_);
+        if(head_ == nullptr) {
+            return nullptr;
+        }
+        return pop();
+    }
+
+    std::size_t size() const {
+        std::lock_guard<std::mutex> locker(mu_);
+        return size_;
+    }
+
+    bool empty() const {
+        std::lock_guard<std::mutex> locker(mu_);
+        return head_ == nullptr;
+    }
+};
+
+/**
+ * Lock free multi producer / single consumer queue (Dmitry Vyukov's intrusive MPSC node based queue)
+ * push() is wait free and can be called from any thread, pop() must be called from single consumer thread
+ * pop() can return nullptr while producer is in the middle of push(), consumer should retry on next wakeup
+ * @tparam T - element type derived from intrusive_queue_hook
+ */
+template <typename T>
+class intrusive_mpsc_queue {
+    static_assert(std::is_base_of<intrusive_queue_hook, T>::value, "T must derive from intrusive_queue_hook");
+
+    // producers side
+    alignas(64) std::atomic<intrusive_queue_hook *> head_;
+    // consumer side
+    alignas(64) intrusive_queue_hook *tail_;
+    intrusive_queue_hook stub_;
+
+    void push_hook(intrusive_queue_hook *hook) {
+        hook->next_hook.store(nullptr, std::memory_order_relaxed);
+        auto *prev = head_.exchange(hook, std::memory_order_acq_rel);
+        // between exchange and store the queue is temporarily disconnected for the consumer
+        prev->next_hook.store(hook, std::memory_order_release);
+    }
+
+public:
+    intrusive_mpsc_queue() : head_(&stub_), tail_(&stub_) {}
+    intrusive_mpsc_queue(const intrusive_mpsc_queue &) = delete;
+    intrusive_mpsc_queue &operator=(const intrusive_mpsc_queue &) = delete;
+
+    void push(T *val) {
+        assert(val != nullptr);
+        push_hook(val);
+    }
+
+    T *pop() {
+        auto *tail = tail_;
+        auto *next = tail->next_hook.load(std::memory_order_acquire);
+        if(tail == &stub_) {
+            if(next == nullptr) {
+                return nullptr;
+            }
+            tail_ = next;
+            tail = next;
+            next = next->next_hook.load(std::memory_order_acquire);
+        }
+        if(next != nullptr) {
+            tail_ = next;
+            // no producer links to tail anymore, element leaves without stale link
+            tail->next_hook.store(nullptr, std::memory_order_relaxed);
+            return static_cast<T *>(tail);
+        }
+        if(tail != head_.load(std::memory_order_acquire)) {
+            // producer did not finish linking yet
+            return nullptr;
+        }
+        push_hook(&stub_);
+        next = tail->next_hook.load(std::memory_order_acquire);
+        if(next != nullptr) {
+            tail_ = next;
+            // no producer links to tail anymore, element leaves without stale link
+            tail->next_hook.store(nullptr, std::memory_order_relaxed);
+            return static_cast<T *>(tail);
+        }
+        return nullptr;
+    }
+
+    /**
+     * Only consumer thread can get reliable answer
+     */
+    bool empty() const {
+        return tail_ == &stub_ && stub_.next_hook.load(std::memory_order_acquire) == nullptr;
+    }
+};
+
+} // namespace mks
+
+#endif // MKS_INTRUSIVE_QUEUE_H
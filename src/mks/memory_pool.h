@@ -5,11 +5,18 @@
 #ifndef MKS_MEMORY_POOL_H
 #define MKS_MEMORY_POOL_H
 
+#include <atomic>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <mks/log.h>
 #include <deque>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
 
 template<typename T>
 class memory_pool {
@@ -64,107 +71,466 @@ public:
 /**
  * Thread safe implementation of memory pool,
  * we can use shared/unique pointers with custom deleter to return object to the pool
+ *
+ * every thread keeps two magazines (arrays of up to MAGAZINE free objects) per pool,
+ * get/put only touch the magazines of the calling thread, the shared depot is locked
+ * once per MAGAZINE objects when thread exchanges empty magazine for full one or vice versa
+ * magazines of exiting thread are returned to the depot, or deleted when the pool is gone
+ *
+ * deleter of unique_ptr/shared_ptr is a single pointer to the anchor, small block refcounted by the pool
+ * and by every pointer it handed out, objects released after the pool is gone are deleted,
+ * control blocks of shared_ptr are cached per thread like the objects
  * @tparam T
+ * @tparam MAGAZINE - objects cached per magazine
  */
-template<typename T>
+template<typename T, std::size_t MAGAZINE = 32>
 class memory_pool_ts {
-    mutable std::mutex mtx_;
-    int max_size_ = 64;
-    std::deque<T*> pool_;
-    std::shared_ptr<memory_pool_ts<T>> self_;
+    static_assert(MAGAZINE > 0, "magazine must hold at least one object");
+
+    struct magazine {
+        std::size_t count = 0;
+        T *objs[MAGAZINE];
+
+        bool full() const {
+            return count == MAGAZINE;
+        }
+
+        void destroy() {
+            for(std::size_t i = 0; i != count; ++i) {
+                delete objs[i];
+            }
+            count = 0;
+        }
+    };
+
+    // shared part, outlives the pool while exiting thread returns its magazines
+    struct depot {
+        std::mutex mtx;
+        std::vector<magazine *> full;
+        std::vector<magazine *> empty;
+        std::size_t objects = 0;
+        std::size_t max_full;
+
+        explicit depot(std::size_t max_size) : max_full((max_size + MAGAZINE - 1) / MAGAZINE) {}
+
+        ~depot() {
+            for(auto *m : full) {
+                m->destroy();
+                delete m;
+            }
+            for(auto *m : empty) {
+                delete m;
+            }
+        }
+
+        // takes ownership of m, objects over the limit are deleted
+        void release(magazine *m) {
+            if(m->count != 0) {
+                std::unique_lock<std::mutex> ll{mtx};
+                if(full.size() < max_full) {
+                    objects += m->count;
+                    full.push_back(m);
+                    return;
+                }
+                ll.unlock();
+                m->destroy();
+            }
+            std::lock_guard<std::mutex> ll{mtx};
+            empty.push_back(m);
+        }
+    };
+
+    // magazines of one thread for one pool
+    struct cache_entry {
+        std::uint64_t id;
+        std::weak_ptr<depot> owner;
+        magazine *loaded;
+        magazine *previous;
+    };
+
+    // storage for shared_ptr control block, free blocks are linked through first bytes
+    union alignas(std::max_align_t) control_block {
+        control_block *next;
+        unsigned char bytes[64];
+    };
+
+    struct thread_cache {
+        std::vector<cache_entry> entries;
+        std::size_t last = 0;
+        // free control blocks, shared by all pools of T
+        control_block *blocks = nullptr;
+        std::size_t block_count = 0;
+
+        ~thread_cache() {
+            for(auto &e : entries) {
+                release(e);
+            }
+            while(blocks != nullptr) {
+                delete std::exchange(blocks, blocks->next);
+            }
+        }
+    };
+
+    // deletes the cache when the thread destroys its thread_locals
+    struct cache_owner {
+        ~cache_owner() {
+            auto *c = cache_;
+            // statics and later thread_local destructors bypass the cache from now on
+            cache_ = nullptr;
+            cache_gone_ = true;
+            delete c;
+        }
+    };
+
+    // trivially destructible, still readable while statics of the main thread are destroyed
+    static thread_local thread_cache *cache_;
+    static thread_local bool cache_gone_;
+    static thread_local cache_owner cache_owner_;
+
+    // cache of calling thread, nullptr after its thread_locals were destroyed
+    static thread_cache *cache() {
+        if(cache_ == nullptr && !cache_gone_) {
+            // first access registers destructor of the owner
+            (void)&cache_owner_;
+            cache_ = new thread_cache;
+        }
+        return cache_;
+    }
+
+    static std::uint64_t next_id() {
+        static std::atomic<std::uint64_t> id{0};
+        return id.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void release(cache_entry &e) {
+        if(auto d = e.owner.lock()) {
+            d->release(e.loaded);
+            d->release(e.previous);
+            return;
+        }
+        // pool is gone
+        e.loaded->destroy();
+        e.previous->destroy();
+        delete e.loaded;
+        delete e.previous;
+    }
+
+    /**
+     * Shared by the pool and its pointers, single state word:
+     * references (pool + unique_ptr/shared_ptr objects) | deleters running put() | closed
+     * deleter entering closed anchor deletes the object, last reference deletes the anchor
+     */
+    class anchor {
+        static constexpr std::uint64_t ref_one = 1;
+        static constexpr std::uint64_t active_one = std::uint64_t(1) << 32;
+        static constexpr std::uint64_t active_mask = ((std::uint64_t(1) << 31) - 1) << 32;
+        static constexpr std::uint64_t closed = std::uint64_t(1) << 63;
+
+        std::atomic<std::uint64_t> state_{ref_one};
+        memory_pool_ts *pool_;
+
+    public:
+        explicit anchor(memory_pool_ts *pool) : pool_(pool) {}
+
+        void acquire() {
+            state_.fetch_add(ref_one, std::memory_order_relaxed);
+        }
+
+        void release() {
+            if(state_.fetch_sub(ref_one, std::memory_order_acq_rel) - ref_one == closed) {
+                delete this;
+            }
+        }
+
+        // returns object of unique_ptr/shared_ptr and drops its reference
+        void recycle(T *ptr) {
+            if(state_.fetch_add(active_one, std::memory_order_acquire) & closed) {
+                delete ptr;
+            } else {
+                pool_->put(ptr);
+            }
+            if(state_.fetch_sub(active_one + ref_one, std::memory_order_acq_rel) - (active_one + ref_one) == closed) {
+                delete this;
+            }
+        }
+
+        // called by the pool destructor, waits for deleters inside put()
+        void close() {
+            state_.fetch_or(closed, std::memory_order_acq_rel);
+            while(state_.load(std::memory_order_acquire) & active_mask) {
+                std::this_thread::yield();
+            }
+        }
+    };
+
+    const std::uint64_t id_ = next_id();
+    std::shared_ptr<depot> depot_ = std::make_shared<depot>(64);
+    anchor *anchor_ = new anchor(this);
+
+    cache_entry *local() {
+        auto *cp = cache();
+        if(cp == nullptr) {
+            return nullptr;
+        }
+        auto &c = *cp;
+        if(c.last < c.entries.size() && c.entries[c.last].id == id_) {
+            return &c.entries[c.last];
+        }
+        for(std::size_t i = 0; i != c.entries.size(); ++i) {
+            if(c.entries[i].id == id_) {
+                c.last = i;
+                return &c.entries[i];
+            }
+        }
+        // first use from this thread, drop magazines of destroyed pools
+        for(std::size_t i = 0; i != c.entries.size();) {
+            if(c.entries[i].owner.expired()) {
+                release(c.entries[i]);
+                c.entries[i] = c.entries.back();
+                c.entries.pop_back();
+            } else {
+                ++i;
+            }
+        }
+        c.entries.push_back(cache_entry{id_, depot_, new magazine, new magazine});
+        c.last = c.entries.size() - 1;
+        return &c.entries.back();
+    }
+
 public:
     bool verbose = false;
 
-    using pool_deleter = std::function<void(T*)>;
+    /**
+     * Deleter of unique_ptr and shared_ptr, returns the object to the pool or deletes it when the pool is gone,
+     * default constructed deleter deletes
+     */
+    class pool_deleter {
+        anchor *anchor_ = nullptr;
+
+    public:
+        pool_deleter() = default;
+        explicit pool_deleter(anchor *a) : anchor_(a) {}
+
+        void operator()(T *ptr) const {
+            if(anchor_ != nullptr) {
+                anchor_->recycle(ptr);
+            } else {
+                delete ptr;
+            }
+        }
+    };
+
     using unique_ptr = std::unique_ptr<T, pool_deleter>;
     using shared_ptr = std::shared_ptr<T>;
 
-    memory_pool_ts() : self_(std::shared_ptr<memory_pool_ts<T>>(this, [](memory_pool_ts<T>* ptr){ /* dont delete this */})) {}
+private:
+    // allocates shared_ptr control blocks from the thread cache
+    template<typename U>
+    class block_allocator {
+        static constexpr bool pooled = sizeof(U) <= sizeof(control_block) && alignof(U) <= alignof(control_block);
 
-    ~memory_pool_ts(){
-        MKS_LOG_CD(verbose, "memory pool delete {}", pool_.size());
-        // delete remaining objects
-        for(auto& ptr : pool_) {
-            MKS_ASSERT(ptr);
-            MKS_LOG_CD(verbose, "deleting {}", (void*)ptr);
-            delete ptr;
+    public:
+        using value_type = U;
+
+        block_allocator() = default;
+        template<typename V>
+        block_allocator(const block_allocator<V> &) {}
+
+        U *allocate(std::size_t n) {
+            if(pooled && n == 1) {
+                auto *c = cache();
+                if(c != nullptr && c->blocks != nullptr) {
+                    --c->block_count;
+                    return reinterpret_cast<U *>(std::exchange(c->blocks, c->blocks->next));
+                }
+                return reinterpret_cast<U *>(new control_block);
+            }
+            return std::allocator<U>().allocate(n);
         }
+
+        void deallocate(U *p, std::size_t n) {
+            if(pooled && n == 1) {
+                auto *c = cache();
+                auto *block = reinterpret_cast<control_block *>(p);
+                if(c != nullptr && c->block_count < MAGAZINE) {
+                    block->next = std::exchange(c->blocks, block);
+                    ++c->block_count;
+                } else {
+                    delete block;
+                }
+                return;
+            }
+            std::allocator<U>().deallocate(p, n);
+        }
+
+        template<typename V>
+        bool operator==(const block_allocator<V> &) const {
+            return true;
+        }
+
+        template<typename V>
+        bool operator!=(const block_allocator<V> &) const {
+            return false;
+        }
+    };
+
+public:
+    memory_pool_ts() = default;
+
+    memory_pool_ts(const memory_pool_ts &) = delete;
+    memory_pool_ts &operator=(const memory_pool_ts &) = delete;
+
+    ~memory_pool_ts(){
+        MKS_LOG_CD(verbose, "memory pool delete {}", size());
+        // objects released from now on are deleted
+        anchor_->close();
+        anchor_->release();
+        flush();
+        // remaining objects are deleted with the depot,
+        // magazines of other threads are deleted when the thread exits or uses other pool
     }
 
+    /**
+     * Objects held by the depot, objects cached by threads are not counted
+     */
     std::size_t size() const {
-        std::lock_guard<std::mutex> ll{mtx_};
-        return pool_.size();
+        std::lock_guard<std::mutex> ll{depot_->mtx};
+        return depot_->objects;
     }
 
+    /**
+     * Limit of the depot, rounded up to whole magazines, every thread can cache additional 2 * MAGAZINE objects
+     */
     void set_max_size(std::size_t size) {
-        std::lock_guard<std::mutex> ll{mtx_};
-        max_size_ = size;
+        std::lock_guard<std::mutex> ll{depot_->mtx};
+        depot_->max_full = (size + MAGAZINE - 1) / MAGAZINE;
+    }
+
+    /**
+     * Returns objects cached by calling thread to the depot
+     */
+    void flush() {
+        // cache of exited thread (static pool destroyed after main) was already returned
+        auto *c = cache_;
+        if(c == nullptr) {
+            return;
+        }
+        for(std::size_t i = 0; i != c->entries.size(); ++i) {
+            if(c->entries[i].id == id_) {
+                release(c->entries[i]);
+                c->entries[i] = c->entries.back();
+                c->entries.pop_back();
+                return;
+            }
+        }
     }
 
     void put(T* ptr) {
-        std::lock_guard<std::mutex> ll{mtx_};
         MKS_ASSERT(ptr != nullptr);
-        if(pool_.size() > max_size_) {
-            MKS_LOG_CD(verbose, "deleting {}", (void*)ptr);
+        auto *ep = local();
+        if(ep == nullptr) {
+            // thread is exiting
             delete ptr;
             return;
         }
-        MKS_LOG_D(verbose, "returning {}", (void*)ptr);
-        pool_.push_back(ptr);
+        auto &e = *ep;
+        if(!e.loaded->full()) {
+            e.loaded->objs[e.loaded->count++] = ptr;
+            return;
+        }
+        if(e.previous->count == 0) {
+            std::swap(e.loaded, e.previous);
+            e.loaded->objs[e.loaded->count++] = ptr;
+            return;
+        }
+        // both full, hand previous over to the depot
+        auto &d = *depot_;
+        magazine *spill = e.previous;
+        magazine *fresh = nullptr;
+        {
+            std::lock_guard<std::mutex> ll{d.mtx};
+            if(d.full.size() < d.max_full) {
+                d.objects += spill->count;
+                d.full.push_back(spill);
+                spill = nullptr;
+                if(!d.empty.empty()) {
+                    fresh = d.empty.back();
+                    d.empty.pop_back();
+                }
+            }
+        }
+        if(spill != nullptr) {
+            MKS_LOG_CD(verbose, "deleting {} objects", spill->count);
+            spill->destroy();
+            fresh = spill;
+        } else if(fresh == nullptr) {
+            fresh = new magazine;
+        }
+        e.previous = e.loaded;
+        e.loaded = fresh;
+        e.loaded->objs[e.loaded->count++] = ptr;
     }
 
     template<typename ...Args>
     T* get(Args&&... args) {
-        std::lock_guard<std::mutex> ll{mtx_};
-        if(pool_.empty()) {
+        auto *ep = local();
+        if(ep == nullptr) {
+            return new T(std::forward<Args>(args)...);
+        }
+        auto &e = *ep;
+        if(e.loaded->count == 0) {
+            if(e.previous->count != 0) {
+                std::swap(e.loaded, e.previous);
+            } else {
+                // both empty, take full magazine from the depot
+                auto &d = *depot_;
+                std::lock_guard<std::mutex> ll{d.mtx};
+                if(!d.full.empty()) {
+                    d.empty.push_back(e.previous);
+                    e.previous = e.loaded;
+                    e.loaded = d.full.back();
+                    d.full.pop_back();
+                    d.objects -= e.loaded->count;
+                }
+            }
+        }
+        if(e.loaded->count == 0) {
             auto* ret = new T(std::forward<Args>(args)...);
-            MKS_LOG_D(verbose, "allocated {}", (void*)ret);
+            MKS_LOG_CD(verbose, "allocated {}", (void*)ret);
             MKS_ASSERT(ret != nullptr);
             return ret;
         }
-        auto* ret = pool_.front();
-        pool_.pop_front();
-        MKS_LOG_D(verbose, "reused {}", (void*)ret);
+        auto* ret = e.loaded->objs[--e.loaded->count];
         MKS_ASSERT(ret != nullptr);
         return ret;
     }
 
     template<typename ...Args>
     unique_ptr get_unique(Args&&... args) {
-        std::weak_ptr<memory_pool_ts<T>> weak = self_;
-        bool shared_ptr_verbose = verbose;
-        return unique_ptr(get(std::forward<Args>(args)...), [weak, shared_ptr_verbose](T* ptr) {
-            std::shared_ptr<memory_pool_ts<T>> self;
-            if((self = weak.lock()) != nullptr) {
-                // when deleted put back to pool
-                self->put(ptr);
-            } else {
-                MKS_LOG_CD(shared_ptr_verbose, "default deleting {}", (void*)ptr);
-                // memory pool lost
-                std::default_delete<T> def;
-                def(ptr);
-            }
-        });
+        auto *ptr = get(std::forward<Args>(args)...);
+        anchor_->acquire();
+        return unique_ptr(ptr, pool_deleter(anchor_));
     }
 
+    /**
+     * Control block is cached per thread too
+     */
     template<typename ...Args>
     shared_ptr get_shared(Args&&... args) {
-        std::weak_ptr<memory_pool_ts<T>> weak = self_;
-        bool shared_ptr_verbose = verbose;
-        return shared_ptr(get(std::forward<Args>(args)...), [weak, shared_ptr_verbose](T* ptr){
-            std::shared_ptr<memory_pool_ts<T>> self;
-            if((self = weak.lock()) != nullptr) {
-                // when deleted put back to pool
-                self->put(ptr);
-            } else {
-                MKS_LOG_CD(shared_ptr_verbose, "default deleting {}", (void*)ptr);
-                // memory pool lost
-                std::default_delete<T> def;
-                def(ptr);
-            }
-        });
+        auto *ptr = get(std::forward<Args>(args)...);
+        anchor_->acquire();
+        return shared_ptr(ptr, pool_deleter(anchor_), block_allocator<T>());
     }
 
 };
 
+template<typename T, std::size_t MAGAZINE>
+thread_local typename memory_pool_ts<T, MAGAZINE>::thread_cache *memory_pool_ts<T, MAGAZINE>::cache_ = nullptr;
+
+template<typename T, std::size_t MAGAZINE>
+thread_local bool memory_pool_ts<T, MAGAZINE>::cache_gone_ = false;
+
+template<typename T, std::size_t MAGAZINE>
+thread_local typename memory_pool_ts<T, MAGAZINE>::cache_owner memory_pool_ts<T, MAGAZINE>::cache_owner_;
+
 #endif //MKS_MEMORY_POOL_H
@@ -0,0 +1,247 @@
+#ifndef MKS_MEMORY_POOL_LF_H
+#define MKS_MEMORY_POOL_LF_H
+
+/*
+ * Lock free memory pool, free objects form Treiber stack
+ *
+ * object is destroyed by put() and constructed by get() with supplied arguments, unlike memory_pool
+ * which reuses live objects, no per thread state, suitable for many short lived threads where
+ * memory_pool_ts magazines do not pay off
+ *
+ * storage is atomic link of the stack followed by the object, link is never overwritten by the object
+ * so a stale head read by losing thread does not race with constructor of the winner
+ * ABA is prevented by 16 bit tag stored in unused top bits of the pointer (48 bit user space addresses),
+ * storage is never freed while the pool lives, so a stale head is always readable,
+ * consequence is there is no size limit, pool keeps storage for the peak number of live objects
+ *
+ * deleter of unique_ptr/shared_ptr is a single pointer to the anchor like in memory_pool_ts,
+ * objects released after the pool is gone are destroyed and their storage freed
+ *
+ * memory_pool_lf<message> pool;
+ * auto *m = pool.get(id, payload);
+ * pool.put(m);
+ * auto u = pool.get_unique(id, payload);
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <utility>
+
+#include <mks/log.h>
+
+template<typename T>
+class memory_pool_lf {
+    struct node {
+        std::atomic<node *> next;
+    };
+
+    // object lives behind the link
+    static constexpr std::size_t payload_offset = (sizeof(node) + alignof(T) - 1) / alignof(T) * alignof(T);
+    static constexpr std::size_t storage_size = payload_offset + sizeof(T);
+    static constexpr std::size_t storage_align = alignof(T) > alignof(node) ? alignof(T) : alignof(node);
+
+    // tagged pointer, tag in the bits above user space addresses
+    static constexpr unsigned tag_shift = sizeof(void *) == 8 ? 48 : 32;
+    static constexpr std::uint64_t ptr_mask = (std::uint64_t(1) << tag_shift) - 1;
+
+    static node *ptr(std::uint64_t tagged) {
+        return reinterpret_cast<node *>(static_cast<std::uintptr_t>(tagged & ptr_mask));
+    }
+
+    static std::uint64_t pack(node *n, std::uint64_t prev) {
+        auto tag = (prev >> tag_shift) + 1;
+        return (tag << tag_shift) | static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(n));
+    }
+
+    static node *allocate() {
+        return ::new(::operator new(storage_size, std::align_val_t(storage_align))) node;
+    }
+
+    static void deallocate(node *n) {
+        n->~node();
+        ::operator delete(n, std::align_val_t(storage_align));
+    }
+
+    static void *payload(node *n) {
+        return reinterpret_cast<char *>(n) + payload_offset;
+    }
+
+    static node *node_of(T *ptr) {
+        return std::launder(reinterpret_cast<node *>(reinterpret_cast<char *>(ptr) - payload_offset));
+    }
+
+    /**
+     * Shared by the pool and its pointers, single state word:
+     * references (pool + unique_ptr/shared_ptr objects) | deleters running put() | closed
+     * deleter entering closed anchor destroys the object, last reference deletes the anchor
+     */
+    class anchor {
+        static constexpr std::uint64_t ref_one = 1;
+        static constexpr std::uint64_t active_one = std::uint64_t(1) << 32;
+        static constexpr std::uint64_t active_mask = ((std::uint64_t(1) << 31) - 1) << 32;
+        static constexpr std::uint64_t closed = std::uint64_t(1) << 63;
+
+        std::atomic<std::uint64_t> state_{ref_one};
+        memory_pool_lf *pool_;
+
+    public:
+        explicit anchor(memory_pool_lf *pool) : pool_(pool) {}
+
+        void acquire() {
+            state_.fetch_add(ref_one, std::memory_order_relaxed);
+        }
+
+        void release() {
+            if(state_.fetch_sub(ref_one, std::memory_order_acq_rel) - ref_one == closed) {
+                delete this;
+            }
+        }
+
+        // returns object of unique_ptr/shared_ptr and drops its reference
+        void recycle(T *ptr) {
+            if(state_.fetch_add(active_one, std::memory_order_acquire) & closed) {
+                // memory pool lost
+                ptr->~T();
+                deallocate(node_of(ptr));
+            } else {
+                pool_->put(ptr);
+            }
+            if(state_.fetch_sub(active_one + ref_one, std::memory_order_acq_rel) - (active_one + ref_one) == closed) {
+                delete this;
+            }
+        }
+
+        // called by the pool destructor, waits for deleters inside put()
+        void close() {
+            state_.fetch_or(closed, std::memory_order_acq_rel);
+            while(state_.load(std::memory_order_acquire) & active_mask) {
+                std::this_thread::yield();
+            }
+        }
+    };
+
+    alignas(64) std::atomic<std::uint64_t> head_{0};
+    // approximate
+    alignas(64) std::atomic<std::size_t> size_{0};
+    anchor *anchor_ = new anchor(this);
+
+    node *pop() {
+        auto old = head_.load(std::memory_order_acquire);
+        for(;;) {
+            auto *n = ptr(old);
+            if(n == nullptr) {
+                return nullptr;
+            }
+            // n can be taken by other thread meanwhile, then the tag makes the exchange fail
+            auto *next = n->next.load(std::memory_order_relaxed);
+            if(head_.compare_exchange_weak(old, pack(next, old), std::memory_order_acquire, std::memory_order_acquire)) {
+                size_.fetch_sub(1, std::memory_order_relaxed);
+                return n;
+            }
+        }
+    }
+
+    void push(node *n) {
+        auto old = head_.load(std::memory_order_relaxed);
+        do {
+            n->next.store(ptr(old), std::memory_order_relaxed);
+        } while(!head_.compare_exchange_weak(old, pack(n, old), std::memory_order_release, std::memory_order_relaxed));
+        size_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+public:
+    bool verbose = false;
+
+    /**
+     * Deleter of unique_ptr and shared_ptr, returns the object to the pool or destroys it when the pool is gone
+     */
+    class pool_deleter {
+        anchor *anchor_ = nullptr;
+
+    public:
+        pool_deleter() = default;
+        explicit pool_deleter(anchor *a) : anchor_(a) {}
+
+        void operator()(T *ptr) const {
+            MKS_ASSERT(anchor_ != nullptr);
+            anchor_->recycle(ptr);
+        }
+    };
+
+    using unique_ptr = std::unique_ptr<T, pool_deleter>;
+    using shared_ptr = std::shared_ptr<T>;
+
+    static_assert(sizeof(void *) <= 8, "tagged pointer needs 64 bit word");
+
+    memory_pool_lf() = default;
+
+    memory_pool_lf(const memory_pool_lf &) = delete;
+    memory_pool_lf &operator=(const memory_pool_lf &) = delete;
+
+    /**
+     * Objects not returned by put() are not destroyed
+     */
+    ~memory_pool_lf() {
+        MKS_LOG_CD(verbose, "memory pool delete {}", size());
+        // objects released from now on are destroyed
+        anchor_->close();
+        anchor_->release();
+        while(auto *n = pop()) {
+            deallocate(n);
+        }
+    }
+
+    /**
+     * Free objects, approximate when other threads use the pool
+     */
+    std::size_t size() const {
+        return size_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Constructs object in pooled storage
+     */
+    template<typename ...Args>
+    T* get(Args&&... args) {
+        auto *n = pop();
+        if(n == nullptr) {
+            n = allocate();
+            MKS_LOG_CD(verbose, "allocated {}", (void *)n);
+        }
+        try {
+            return ::new(payload(n)) T(std::forward<Args>(args)...);
+        } catch(...) {
+            push(n);
+            throw;
+        }
+    }
+
+    /**
+     * Destroys object and keeps its storage, ptr must come from get() of this pool
+     */
+    void put(T* ptr) {
+        MKS_ASSERT(ptr != nullptr);
+        ptr->~T();
+        push(node_of(ptr));
+    }
+
+    template<typename ...Args>
+    unique_ptr get_unique(Args&&... args) {
+        auto *ptr = get(std::forward<Args>(args)...);
+        anchor_->acquire();
+        return unique_ptr(ptr, pool_deleter(anchor_));
+    }
+
+    template<typename ...Args>
+    shared_ptr get_shared(Args&&... args) {
+        auto *ptr = get(std::forward<Args>(args)...);
+        anchor_->acquire();
+        return shared_ptr(ptr, pool_deleter(anchor_));
+    }
+};
+
+#endif // MKS_MEMORY_POOL_LF_H
@@ -0,0 +1,130 @@
+#ifndef MKS_MEMORY_POOL_SLAB_H
+#define MKS_MEMORY_POOL_SLAB_H
+
+/*
+ * Slab backed memory pool, not thread safe
+ *
+ * objects are carved from large aligned chunks of mks::slab so objects of one pool are adjacent in memory,
+ * get(args...) always constructs the object in place with the arguments and put() destroys it
+ *
+ * types which are cheaper to reset than to destroy and construct can skip that with Reset policy,
+ * then put() keeps the object alive (up to max_size idle objects) and get(args...) on reuse calls
+ *      Reset::reset(T &obj, Args&&... args)
+ *
+ * struct buffer_reset {
+ *     static void reset(std::string &s) { s.clear(); }
+ * };
+ * memory_pool_slab<std::string, buffer_reset> pool;
+ * auto *s = pool.get();
+ * pool.put(s);
+ */
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <mks/log.h>
+
+#include "slab.h"
+
+/**
+ * Default Reset policy of memory_pool_slab, objects are destroyed by put()
+ */
+struct slab_no_reset {};
+
+template<typename T, typename Reset = slab_no_reset>
+class memory_pool_slab {
+    static constexpr bool resettable = !std::is_same<Reset, slab_no_reset>::value;
+
+    mks::slab slab_;
+    // alive objects waiting for reset, only with Reset policy
+    std::vector<T*> idle_;
+    std::size_t max_size_ = 64;
+
+    template<typename ...Args>
+    T* construct(Args&&... args) {
+        void *p = slab_.allocate();
+        try {
+            return ::new(p) T(std::forward<Args>(args)...);
+        } catch(...) {
+            slab_.deallocate(p);
+            throw;
+        }
+    }
+
+    void destroy(T* ptr) {
+        ptr->~T();
+        slab_.deallocate(ptr);
+    }
+
+public:
+    explicit memory_pool_slab(std::size_t chunk_size = mks::slab::default_chunk_size)
+        : slab_(sizeof(T), alignof(T), chunk_size) {}
+
+    memory_pool_slab(const memory_pool_slab &) = delete;
+    memory_pool_slab &operator=(const memory_pool_slab &) = delete;
+
+    /**
+     * Objects not returned by put() are not destroyed, their memory is released
+     */
+    ~memory_pool_slab() {
+        for(auto *ptr : idle_) {
+            destroy(ptr);
+        }
+    }
+
+    /**
+     * Objects which get() can return without asking the system for memory
+     */
+    std::size_t size() const {
+        return idle_.size() + slab_.capacity() - slab_.live();
+    }
+
+    /**
+     * Limit of idle alive objects kept by Reset policy, memory of destroyed objects stays in the slab
+     */
+    void set_max_size(std::size_t size) {
+        max_size_ = size;
+    }
+
+    void reserve(std::size_t n) {
+        slab_.reserve(n);
+    }
+
+    /**
+     * Returns chunks without objects to the system
+     */
+    std::size_t trim() {
+        return slab_.trim();
+    }
+
+    template<typename ...Args>
+    T* get(Args&&... args) {
+        if constexpr(resettable) {
+            if(!idle_.empty()) {
+                auto *ret = idle_.back();
+                idle_.pop_back();
+                Reset::reset(*ret, std::forward<Args>(args)...);
+                return ret;
+            }
+        }
+        return construct(std::forward<Args>(args)...);
+    }
+
+    /**
+     * @param ptr - object returned by get() of this pool
+     */
+    void put(T* ptr) {
+        MKS_ASSERT(ptr != nullptr);
+        if constexpr(resettable) {
+            if(idle_.size() < max_size_) {
+                idle_.push_back(ptr);
+                return;
+            }
+        }
+        destroy(ptr);
+    }
+};
+
+#endif // MKS_MEMORY_POOL_SLAB_H
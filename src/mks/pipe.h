@@ -1,7 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <mks/log.h>
 
 #ifdef _WIN32
@@ -14,6 +17,12 @@
 #include <fcntl.h>
 #endif
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+// single eventfd counter instead of pipe, one read drains all pending notifications
+#define MKS_PIPE_EVENTFD
+#endif
+
 namespace mks {
 
 #ifdef _WIN32
@@ -91,23 +100,19 @@ public:
     }
 
     bool notify() {
-        char buf[1] = { '\0' };
-
         if(!inited_) {
             ++pre_init_notify_;
             MKS_LOG_D("pre-init {}", pre_init_notify_);
             return true;
         }
-
-#ifdef _WIN32
-        if (::send(pipe_[1], buf, sizeof(buf), 0) <= 0) {
-            return false;
+        // loop thread is already signaled and did not process yet, no need for another syscall
+        if(pending_.exchange(true, std::memory_order_acq_rel)) {
+            return true;
         }
-#else
-        if (::write(pipe_[1], buf, sizeof(buf)) <= 0) {
+        if(!signal(1)) {
+            pending_.store(false, std::memory_order_release);
             return false;
         }
-#endif
         return true;
     }
 
@@ -126,7 +131,16 @@ public:
         return pipe_[0];
     }
 
+    /**
+     * Handler is called once per drain, notifications coalesced while pending
+     * (and on eventfd everything accumulated since the last process()) are consumed by single read
+     */
     bool process() {
+#if defined(MKS_PIPE_EVENTFD)
+        eventfd_t count = 0;
+        auto n = ::read(pipe_[0], &count, sizeof(count));
+        if (n == sizeof(count) && count != 0) {
+#else
         char buf[1];
 #ifdef _WIN32
         auto n = ::recv(pipe_[0], buf, sizeof(buf), 0);
@@ -134,6 +148,10 @@ public:
         auto n = ::read(pipe_[0], buf, sizeof(buf));
 #endif
         if (n == 1) {
+#endif
+            // cleared before handler runs, notify() coming during handler will signal again
+            // read-modify-write so notify() that saw pending and skipped the signal is ordered before handler
+            pending_.exchange(false, std::memory_order_acq_rel);
             MKS_ASSERT(handler_);
             handler_();
             return true;
@@ -153,6 +171,13 @@ public:
             close();
             return false;
         }
+#elif defined(MKS_PIPE_EVENTFD)
+        auto efd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (efd < 0) {
+            return false;
+        }
+        pipe_[0] = efd;
+        pipe_[1] = efd;
 #else
         pipe(pipe_);
 #endif
@@ -162,10 +187,10 @@ public:
 
         if(pre_init_notify_ != 0) {
             MKS_LOG_D("notify pre-init {}", pre_init_notify_);
-            for(std::size_t i = 0; i != pre_init_notify_; ++i) {
-                auto ret = notify();
-                MKS_ASSERT(ret);
-            }
+            // all notifications before init are coalesced into single wakeup
+            pending_.store(true, std::memory_order_release);
+            auto ret = signal(1);
+            MKS_ASSERT(ret);
             pre_init_notify_ = 0;
         }
 
@@ -175,15 +200,41 @@ public:
     void close() {
         if(pipe_[0] > 0) {
             mks_closesocket(pipe_[0]);
-            mks_closesocket(pipe_[1]);
+            if(pipe_[1] != pipe_[0]) {
+                mks_closesocket(pipe_[1]);
+            }
             memset(pipe_, 0, sizeof(pipe_[0]) * 2);
         }
         inited_ = false;
+        pending_.store(false, std::memory_order_release);
     }
 
 private:
+    bool signal(uint64_t count) {
+#if defined(MKS_PIPE_EVENTFD)
+        eventfd_t value = count;
+        if (::write(pipe_[1], &value, sizeof(value)) != sizeof(value)) {
+            return false;
+        }
+#else
+        char buf[1] = { '\0' };
+        (void)count;
+#ifdef _WIN32
+        if (::send(pipe_[1], buf, sizeof(buf), 0) <= 0) {
+            return false;
+        }
+#else
+        if (::write(pipe_[1], buf, sizeof(buf)) <= 0) {
+            return false;
+        }
+#endif
+#endif
+        return true;
+    }
+
     Handler handler_;
-    mks_socket_t pipe_[2] = {0, 0}; // Write to pipe_[0] , Read from pipe_[1]
+    std::atomic<bool> pending_{false};
+    mks_socket_t pipe_[2] = {0, 0}; // Write to pipe_[0] , Read from pipe_[1], with eventfd both are the same fd
 };
 
 }
@@ -0,0 +1,129 @@
+#include "pmr.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include <mks/log.h>
+
+namespace mks {
+namespace pmr {
+
+namespace {
+
+char *align_up(char *p, std::size_t alignment) {
+    auto v = reinterpret_cast<std::uintptr_t>(p);
+    return p + ((alignment - v % alignment) % alignment);
+}
+
+} // namespace
+
+arena_resource::arena_resource(std::size_t chunk_size, std::pmr::memory_resource *upstream)
+    : chunk_size_(chunk_size), upstream_(upstream) {
+    MKS_ASSERT(upstream_ != nullptr);
+}
+
+arena_resource::~arena_resource() {
+    release();
+}
+
+void arena_resource::reset() {
+    if(chunks_.empty()) {
+        return;
+    }
+    use(0);
+}
+
+void arena_resource::release() {
+    for(auto &c : chunks_) {
+        upstream_->deallocate(c.data, c.size, alignof(std::max_align_t));
+    }
+    chunks_.clear();
+    capacity_ = 0;
+    current_ = 0;
+    cur_ = end_ = nullptr;
+}
+
+void arena_resource::use(std::size_t index) {
+    current_ = index;
+    cur_ = chunks_[index].data;
+    end_ = cur_ + chunks_[index].size;
+}
+
+void *arena_resource::do_allocate(std::size_t bytes, std::size_t alignment) {
+    auto *p = align_up(cur_, alignment);
+    if(cur_ != nullptr && p <= end_ && static_cast<std::size_t>(end_ - p) >= bytes) {
+        cur_ = p + bytes;
+        return p;
+    }
+    // chunks kept by reset()
+    for(auto index = current_ + 1; index < chunks_.size(); ++index) {
+        use(index);
+        p = align_up(cur_, alignment);
+        if(p <= end_ && static_cast<std::size_t>(end_ - p) >= bytes) {
+            cur_ = p + bytes;
+            return p;
+        }
+    }
+    auto size = std::max(chunk_size_, bytes + alignment);
+    chunks_.push_back(chunk{static_cast<char *>(upstream_->allocate(size, alignof(std::max_align_t))), size});
+    capacity_ += size;
+    use(chunks_.size() - 1);
+    p = align_up(cur_, alignment);
+    cur_ = p + bytes;
+    return p;
+}
+
+slab_resource::slab_resource(std::size_t max_block, std::pmr::memory_resource *upstream, std::size_t chunk_size)
+    : upstream_(upstream) {
+    MKS_ASSERT(upstream_ != nullptr);
+    for(std::size_t size = min_block; size <= max_block; size <<= 1) {
+        // chunks come from upstream, so arena or monotonic upstream backs the whole resource
+        classes_.emplace_back(new slab(size, std::min(size, alignof(std::max_align_t)), chunk_size, upstream_));
+    }
+}
+
+std::size_t slab_resource::class_of(std::size_t bytes, std::size_t alignment) const {
+    if(alignment > alignof(std::max_align_t)) {
+        return classes_.size();
+    }
+    // block of class is aligned to min(size, max_align_t)
+    bytes = std::max({bytes, alignment, min_block});
+    std::size_t index = 0;
+    for(auto size = min_block; size < bytes; size <<= 1) {
+        ++index;
+    }
+    return std::min(index, classes_.size());
+}
+
+void *slab_resource::do_allocate(std::size_t bytes, std::size_t alignment) {
+    auto index = class_of(bytes, alignment);
+    if(index == classes_.size()) {
+        return upstream_->allocate(bytes, alignment);
+    }
+    return classes_[index]->allocate();
+}
+
+void slab_resource::do_deallocate(void *p, std::size_t bytes, std::size_t alignment) {
+    auto index = class_of(bytes, alignment);
+    if(index == classes_.size()) {
+        upstream_->deallocate(p, bytes, alignment);
+        return;
+    }
+    classes_[index]->deallocate(p);
+}
+
+std::size_t slab_resource::trim() {
+    std::size_t released = 0;
+    for(auto &s : classes_) {
+        released += s->trim();
+    }
+    return released;
+}
+
+std::pmr::memory_resource *thread_resource() {
+    static thread_local slab_resource resource;
+    return &resource;
+}
+
+} // namespace pmr
+} // namespace mks
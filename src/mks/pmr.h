@@ -0,0 +1,161 @@
+#ifndef MKS_PMR_H
+#define MKS_PMR_H
+
+/*
+ * std::pmr::memory_resource implementations for standard containers and the library containers
+ * taking allocator (queue_buffer, broadcaster, see mks::pmr aliases next to them)
+ *
+ * arena_resource             - monotonic bump allocator, deallocate is no-op, reset() reuses chunks
+ * slab_resource              - size classed pool on mks::slab (same code as memory_pool_slab), not thread safe
+ * synchronized_slab_resource - slab_resource behind a mutex
+ * thread_resource()          - slab_resource of the calling thread, memory must be freed by the same thread
+ *                              before it exits, must not back containers shared between threads
+ *
+ * mks::pmr::arena_resource arena;
+ * std::pmr::vector<int> v(&arena);
+ * // queue is filled and drained by different threads
+ * mks::pmr::synchronized_slab_resource resource;
+ * mks::pmr::queue_buffer<message> queue(std::pmr::polymorphic_allocator<message>(&resource));
+ */
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+#include "slab.h"
+
+namespace mks {
+namespace pmr {
+
+/**
+ * Monotonic arena, memory is released by reset() (chunks are kept for reuse) or release()
+ */
+class arena_resource : public std::pmr::memory_resource {
+public:
+    /**
+     * @param chunk_size - bytes requested from upstream at once, bigger allocations get own chunk
+     */
+    explicit arena_resource(std::size_t chunk_size = 64 * 1024,
+                            std::pmr::memory_resource *upstream = std::pmr::get_default_resource());
+    ~arena_resource() override;
+
+    arena_resource(const arena_resource &) = delete;
+    arena_resource &operator=(const arena_resource &) = delete;
+
+    /**
+     * Forgets all allocations, chunks stay allocated
+     */
+    void reset();
+
+    /**
+     * Forgets all allocations and returns chunks to upstream
+     */
+    void release();
+
+    /**
+     * Bytes held from upstream
+     */
+    std::size_t capacity() const {
+        return capacity_;
+    }
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void *, std::size_t, std::size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+private:
+    struct chunk {
+        char *data;
+        std::size_t size;
+    };
+
+    void use(std::size_t index);
+
+    std::size_t chunk_size_;
+    std::pmr::memory_resource *upstream_;
+    std::vector<chunk> chunks_;
+    std::size_t capacity_ = 0;
+    // chunk being carved, chunks behind it are unused since reset()
+    std::size_t current_ = 0;
+    char *cur_ = nullptr;
+    char *end_ = nullptr;
+};
+
+/**
+ * Size classes of powers of two from 8 to max_block bytes, each backed by mks::slab with chunks
+ * allocated from upstream (aligned to the chunk size), bigger or over aligned allocations go to upstream too
+ */
+class slab_resource : public std::pmr::memory_resource {
+public:
+    static constexpr std::size_t min_block = 8;
+
+    explicit slab_resource(std::size_t max_block = 4096,
+                           std::pmr::memory_resource *upstream = std::pmr::get_default_resource(),
+                           std::size_t chunk_size = slab::default_chunk_size);
+
+    slab_resource(const slab_resource &) = delete;
+    slab_resource &operator=(const slab_resource &) = delete;
+
+    /**
+     * Returns chunks without live blocks to the system
+     * @return number of released chunks
+     */
+    std::size_t trim();
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+private:
+    // index of size class or classes_.size() for upstream
+    std::size_t class_of(std::size_t bytes, std::size_t alignment) const;
+
+    std::vector<std::unique_ptr<slab>> classes_;
+    std::pmr::memory_resource *upstream_;
+};
+
+/**
+ * Thread safe slab_resource
+ */
+class synchronized_slab_resource : public slab_resource {
+public:
+    using slab_resource::slab_resource;
+
+    std::size_t trim() {
+        std::lock_guard<std::mutex> ll{mtx_};
+        return slab_resource::trim();
+    }
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        std::lock_guard<std::mutex> ll{mtx_};
+        return slab_resource::do_allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override {
+        std::lock_guard<std::mutex> ll{mtx_};
+        slab_resource::do_deallocate(p, bytes, alignment);
+    }
+
+private:
+    std::mutex mtx_;
+};
+
+/**
+ * slab_resource owned by the calling thread, destroyed when the thread exits,
+ * not thread safe, use synchronized_slab_resource for containers shared between threads
+ */
+std::pmr::memory_resource *thread_resource();
+
+} // namespace pmr
+} // namespace mks
+
+#endif // MKS_PMR_H
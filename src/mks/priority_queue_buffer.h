@@ -0,0 +1,209 @@
+#ifndef MKS_PRIORITY_QUEUE_BUFFER_H
+#define MKS_PRIORITY_QUEUE_BUFFER_H
+
+#include <array>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*
+ * Blocking queue with fixed number of priority lanes, lane 0 has the highest priority
+ * non empty lanes are tracked in a bitmap so both add and remove are O(1)
+ *
+ * optional starvation guard: after 'starvation_limit' consecutive removals served while some
+ * lower priority lane was waiting, one item is taken from the lowest priority non empty lane
+ */
+
+namespace mks {
+
+namespace detail {
+
+inline unsigned lane_lowest_bit(std::uint64_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctzll(mask));
+#endif
+}
+
+inline unsigned lane_highest_bit(std::uint64_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return 63u - static_cast<unsigned>(__builtin_clzll(mask));
+#endif
+}
+
+} // namespace detail
+
+template <typename T, std::size_t LANES = 4, typename Alloc = std::allocator<T>,
+          template <typename U = T, typename A = Alloc> class V = std::deque>
+class priority_queue_buffer {
+    static_assert(LANES > 0 && LANES <= 64, "lane bitmap is 64 bits wide");
+
+public:
+    static constexpr std::size_t lanes = LANES;
+
+    void add(const T &val, std::size_t lane = LANES - 1) {
+        std::unique_lock<std::mutex> locker(mu_);
+        push_back(lane, val);
+        locker.unlock();
+        cond_.notify_one();
+    }
+
+    void add(T &&val, std::size_t lane = LANES - 1) {
+        std::unique_lock<std::mutex> locker(mu_);
+        push_back(lane, std::move(val));
+        locker.unlock();
+        cond_.notify_one();
+    }
+
+    void add_first(const T &val, std::size_t lane = 0) {
+        std::unique_lock<std::mutex> locker(mu_);
+        push_front(lane, val);
+        locker.unlock();
+        cond_.notify_one();
+    }
+
+    void add_first(T &&val, std::size_t lane = 0) {
+        std::unique_lock<std::mutex> locker(mu_);
+        push_front(lane, std::move(val));
+        locker.unlock();
+        cond_.notify_one();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> locker(mu_);
+        for(auto &lane : lanes_) {
+            lane.clear();
+        }
+        mask_ = 0;
+        size_ = 0;
+        consecutive_ = 0;
+    }
+
+    T remove() {
+        std::unique_lock<std::mutex> locker(mu_);
+        cond_.wait(locker, [this]() { return mask_ != 0; });
+        return pop();
+    }
+
+    bool try_remove(const std::function<void(T &)> &cb) {
+        std::unique_lock<std::mutex> locker(mu_);
+        if(mask_ == 0) {
+            return false;
+        }
+        T val = pop();
+        locker.unlock();
+        cb(val);
+        return true;
+    }
+
+    /**
+     * Maximum consecutive removals served while lower priority lane has data, 0 disables the guard
+     */
+    void set_starvation_limit(std::size_t limit) {
+        std::lock_guard<std::mutex> locker(mu_);
+        starvation_limit_ = limit;
+        consecutive_ = 0;
+    }
+
+    std::vector<T> state() {
+        std::lock_guard<std::mutex> locker(mu_);
+        std::vector<T> copy;
+        copy.reserve(size_);
+        for(const auto &lane : lanes_) {
+            for(const auto &it : lane) {
+                copy.push_back(it);
+            }
+        }
+        return copy;
+    }
+
+    std::size_t lane_size(std::size_t lane) const {
+        std::lock_guard<std::mutex> locker(mu_);
+        return lanes_[lane].size();
+    }
+
+    std::size_t size() const {
+        std::lock_guard<std::mutex> locker(mu_);
+        return size_;
+    }
+
+    bool empty() const {
+        std::lock_guard<std::mutex> locker(mu_);
+        return size_ == 0;
+    }
+
+private:
+    mutable std::mutex mu_;
+    std::condition_variable cond_;
+
+    std::array<V<T, Alloc>, LANES> lanes_;
+    std::uint64_t mask_ = 0;
+    std::size_t size_ = 0;
+    std::size_t starvation_limit_ = 0;
+    std::size_t consecutive_ = 0;
+
+    template <typename Arg>
+    void push_back(std::size_t lane, Arg &&val) {
+        assert(lane < LANES);
+        lanes_[lane].push_back(std::forward<Arg>(val));
+        mask_ |= std::uint64_t(1) << lane;
+        ++size_;
+    }
+
+    template <typename Arg>
+    void push_front(std::size_t lane, Arg &&val) {
+        assert(lane < LANES);
+        lanes_[lane].push_front(std::forward<Arg>(val));
+        mask_ |= std::uint64_t(1) << lane;
+        ++size_;
+    }
+
+    std::size_t select_lane() {
+        auto lane = detail::lane_lowest_bit(mask_);
+        if(starvation_limit_ == 0) {
+            return lane;
+        }
+        auto lowest = detail::lane_highest_bit(mask_);
+        if(lowest == lane) {
+            // nobody is waiting behind this lane
+            consecutive_ = 0;
+            return lane;
+        }
+        if(++consecutive_ > starvation_limit_) {
+            consecutive_ = 0;
+            return lowest;
+        }
+        return lane;
+    }
+
+    T pop() {
+        assert(mask_ != 0);
+        auto lane = select_lane();
+        auto &buffer = lanes_[lane];
+        T val = std::move(buffer.front());
+        buffer.pop_front();
+        if(buffer.empty()) {
+            mask_ &= ~(std::uint64_t(1) << lane);
+        }
+        --size_;
+        return val;
+    }
+};
+
+} // namespace mks
+#endif // MKS_PRIORITY_QUEUE_BUFFER_H
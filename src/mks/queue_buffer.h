@@ -7,18 +7,37 @@
 
 #include <condition_variable>
 #include <deque>
+#include <functional>
+#include <limits>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+#include "queue_stats.h"
 
 namespace mks {
 
-template <typename T, typename Alloc = std::allocator<T>, template <typename U = T, typename A = Alloc> class V = std::deque>
+/**
+ * Blocking FIFO queue
+ * @tparam Stats - instrumentation policy, see queue_stats.h, default queue_no_stats has no overhead
+ */
+template <typename T, typename Alloc = std::allocator<T>, template <typename U = T, typename A = Alloc> class V = std::deque,
+          typename Stats = queue_no_stats>
 class queue_buffer {
 
 public:
+    queue_buffer() = default;
+
+    /**
+     * @param alloc - allocator of the underlying container, see mks::pmr::queue_buffer
+     */
+    explicit queue_buffer(const Alloc &alloc) : buffer_(alloc) {}
 
     void add_first(const T &num) {
         std::unique_lock<std::mutex> locker(mu_);
         cond_.wait(locker, [this]() { return buffer_.size() < size_; });
         buffer_.push_front(num);
+        stats_.on_push_front(buffer_.size());
         locker.unlock();
         cond_.notify_one();
     }
@@ -27,6 +46,7 @@ public:
         std::unique_lock<std::mutex> locker(mu_);
         cond_.wait(locker, [this]() { return buffer_.size() < size_; });
         buffer_.push_front(std::forward<T>(num));
+        stats_.on_push_front(buffer_.size());
         locker.unlock();
         cond_.notify_one();
     }
@@ -35,6 +55,7 @@ public:
         std::unique_lock<std::mutex> locker(mu_);
         cond_.wait(locker, [this]() { return buffer_.size() < size_; });
         buffer_.push_back(num);
+        stats_.on_push_back(buffer_.size());
         locker.unlock();
         cond_.notify_one();
     }
@@ -43,6 +64,7 @@ public:
         std::unique_lock<std::mutex> locker(mu_);
         cond_.wait(locker, [this]() { return buffer_.size() < size_; });
         buffer_.push_back(std::forward<T>(num));
+        stats_.on_push_back(buffer_.size());
         locker.unlock();
         cond_.notify_one();
     }
@@ -50,6 +72,7 @@ public:
     void clear() {
         std::unique_lock<std::mutex> locker(mu_);
         buffer_.clear();
+        stats_.on_clear(0);
         locker.unlock();
         cond_.notify_one();
     }
@@ -60,15 +83,19 @@ public:
         for(std::size_t i = 0; i != count; ++i) {
             buffer_.push_back(val);
         }
+        stats_.on_clear(buffer_.size());
         locker.unlock();
         cond_.notify_one();
     }
 
     T remove() {
         std::unique_lock<std::mutex> locker(mu_);
+        auto token = stats_.wait_begin(buffer_.empty());
         cond_.wait(locker, [this]() { return buffer_.size() > 0; });
+        stats_.wait_end(token);
         T back = std::move(buffer_.front());
         buffer_.pop_front();
+        stats_.on_pop_front(buffer_.size());
         locker.unlock();
         cond_.notify_one();
         return back;
@@ -79,6 +106,7 @@ public:
         if(!buffer_.empty()) {
             T back = std::move(buffer_.front());
             buffer_.pop_front();
+            stats_.on_pop_front(buffer_.size());
             locker.unlock();
             cond_.notify_one();
             cb(back);
@@ -102,27 +130,57 @@ public:
         for(auto &&it : buffer_) {
             copy.push_back(std::forward<T>(it));
         }
+        for(auto left = buffer_.size(); left != 0; --left) {
+            stats_.on_pop_front(left - 1);
+        }
         buffer_.clear();
         return copy;
     }
 
     std::size_t size() const {
+        std::lock_guard<std::mutex> locker(mu_);
         return buffer_.size();
     }
 
     bool empty() const {
+        std::lock_guard<std::mutex> locker(mu_);
         return buffer_.empty();
     }
 
+    /**
+     * Instrumentation, snapshot() is safe to call from any thread
+     */
+    const Stats &stats() const {
+        return stats_;
+    }
+
+    Stats &stats() {
+        return stats_;
+    }
+
 private:
     // Add them as member variables here
-    std::mutex mu_;
+    mutable std::mutex mu_;
     std::condition_variable cond_;
 
     // Your normal variables here
     V<T, Alloc> buffer_;
     const unsigned long size_ = std::numeric_limits<unsigned long>::max();
+    Stats stats_;
 };
 
+template <typename T>
+using instrumented_queue_buffer = queue_buffer<T, std::allocator<T>, std::deque, queue_stats>;
+
+namespace pmr {
+
+/**
+ * queue_buffer with container memory from std::pmr::memory_resource, see pmr.h
+ */
+template <typename T, typename Stats = queue_no_stats>
+using queue_buffer = mks::queue_buffer<T, std::pmr::polymorphic_allocator<T>, std::deque, Stats>;
+
+} // namespace pmr
+
 } // namespace mks
 #endif // MKS_QUEUE_BUFFER_H
@@ -0,0 +1,288 @@
+#ifndef MKS_QUEUE_STATS_H
+#define MKS_QUEUE_STATS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*
+ * Instrumentation policies for queue_buffer
+ *
+ * queue_no_stats - default, every hook is empty and inlined away
+ * queue_stats    - depth high water mark, enqueue/dequeue counters, time spent in queue (sampled)
+ *                  and time consumers spent blocked, all values are relaxed atomics so snapshot()
+ *                  can be called from any thread without taking the queue lock
+ *
+ * mks::queue_buffer<msg, std::allocator<msg>, std::deque, mks::queue_stats> q;
+ * auto s = q.stats().snapshot();
+ * MKS_LOG_D("depth={} p99={}ns", s.depth, s.queued.percentile(0.99));
+ */
+
+namespace mks {
+
+/**
+ * Copy of latency_histogram taken at some point in time
+ * bucket i holds samples in range [2^(i-1), 2^i) nanoseconds, bucket 0 holds zero samples
+ */
+struct histogram_snapshot {
+    static constexpr std::size_t buckets = 64;
+
+    std::array<std::uint64_t, buckets> counts{};
+    std::uint64_t count = 0;
+    std::uint64_t sum_ns = 0;
+    std::uint64_t max_ns = 0;
+
+    std::uint64_t mean_ns() const {
+        return count == 0 ? 0 : sum_ns / count;
+    }
+
+    /**
+     * @param p - 0.0 - 1.0
+     * @return upper bound of the bucket containing requested percentile
+     */
+    std::uint64_t percentile(double p) const {
+        if(count == 0) {
+            return 0;
+        }
+        auto rank = static_cast<std::uint64_t>(p * static_cast<double>(count));
+        std::uint64_t seen = 0;
+        for(std::size_t i = 0; i != buckets; ++i) {
+            seen += counts[i];
+            if(seen > rank) {
+                return i == 0 ? 0 : (i >= 63 ? max_ns : (std::uint64_t(1) << i) - 1);
+            }
+        }
+        return max_ns;
+    }
+};
+
+/**
+ * Power of two bucketed histogram, single record() is few relaxed atomic increments
+ */
+class latency_histogram {
+    std::array<std::atomic<std::uint64_t>, histogram_snapshot::buckets> counts_{};
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> sum_ns_{0};
+    std::atomic<std::uint64_t> max_ns_{0};
+
+    static std::size_t bucket(std::uint64_t ns) {
+        if(ns == 0) {
+            return 0;
+        }
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, ns);
+        return std::min<std::size_t>(index + 1, histogram_snapshot::buckets - 1);
+#else
+        return std::min<std::size_t>(64 - __builtin_clzll(ns), histogram_snapshot::buckets - 1);
+#endif
+    }
+
+public:
+    void record(std::uint64_t ns) {
+        counts_[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+        auto prev = max_ns_.load(std::memory_order_relaxed);
+        while(prev < ns && !max_ns_.compare_exchange_weak(prev, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    template <class Rep, class Period>
+    void record(const std::chrono::duration<Rep, Period> &time) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+        record(ns < 0 ? 0 : static_cast<std::uint64_t>(ns));
+    }
+
+    histogram_snapshot snapshot() const {
+        histogram_snapshot ret;
+        for(std::size_t i = 0; i != histogram_snapshot::buckets; ++i) {
+            ret.counts[i] = counts_[i].load(std::memory_order_relaxed);
+        }
+        ret.count = count_.load(std::memory_order_relaxed);
+        ret.sum_ns = sum_ns_.load(std::memory_order_relaxed);
+        ret.max_ns = max_ns_.load(std::memory_order_relaxed);
+        return ret;
+    }
+
+    void reset() {
+        for(auto &it : counts_) {
+            it.store(0, std::memory_order_relaxed);
+        }
+        count_.store(0, std::memory_order_relaxed);
+        sum_ns_.store(0, std::memory_order_relaxed);
+        max_ns_.store(0, std::memory_order_relaxed);
+    }
+};
+
+struct queue_stats_snapshot {
+    std::chrono::steady_clock::time_point when;
+    std::uint64_t depth = 0;
+    std::uint64_t high_water = 0;
+    std::uint64_t enqueued = 0;
+    std::uint64_t dequeued = 0;
+    // time items spent in the queue
+    histogram_snapshot queued;
+    // time consumers spent waiting on empty queue
+    histogram_snapshot blocked;
+};
+
+/**
+ * Rate of operations per second between two snapshots
+ */
+inline double queue_rate(std::uint64_t prev_count, std::uint64_t count,
+                         std::chrono::steady_clock::duration elapsed) {
+    auto secs = std::chrono::duration<double>(elapsed).count();
+    return secs <= 0 ? 0.0 : static_cast<double>(count - prev_count) / secs;
+}
+
+/**
+ * Default policy, compiled out completely
+ */
+struct queue_no_stats {
+    struct wait_token {};
+
+    void on_push_back(std::size_t) {}
+    void on_push_front(std::size_t) {}
+    void on_pop_front(std::size_t) {}
+    void on_clear(std::size_t) {}
+    wait_token wait_begin(bool) { return {}; }
+    void wait_end(const wait_token &) {}
+
+    queue_stats_snapshot snapshot() const {
+        queue_stats_snapshot ret;
+        ret.when = std::chrono::steady_clock::now();
+        return ret;
+    }
+};
+
+/**
+ * Recording policy, on_* hooks are called by the queue with its lock held
+ * time spent in queue is measured for every sample_period-th item added by push_back, items are
+ * numbered in queue order so the sample is matched on pop without touching the queue content,
+ * samples live in fixed ring, sampling pauses while the ring is full
+ */
+class queue_stats {
+    using clock = std::chrono::steady_clock;
+
+public:
+    static constexpr std::uint64_t sample_period = 64;
+    static constexpr std::size_t sample_slots = 64;
+
+private:
+    struct sample {
+        std::uint64_t seq;
+        clock::time_point when;
+    };
+
+    // sequence of the front item and behind the back item, push_front numbers below the front
+    std::uint64_t head_seq_ = 0;
+    std::uint64_t tail_seq_ = 0;
+    // ring of samples ordered by seq
+    std::array<sample, sample_slots> samples_;
+    std::size_t sample_first_ = 0;
+    std::size_t sample_count_ = 0;
+
+    std::atomic<std::uint64_t> depth_{0};
+    std::atomic<std::uint64_t> high_water_{0};
+    std::atomic<std::uint64_t> enqueued_{0};
+    std::atomic<std::uint64_t> dequeued_{0};
+    latency_histogram queued_;
+    latency_histogram blocked_;
+
+    void update_depth(std::size_t depth) {
+        depth_.store(depth, std::memory_order_relaxed);
+        if(depth > high_water_.load(std::memory_order_relaxed)) {
+            high_water_.store(depth, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    struct wait_token {
+        bool waiting = false;
+        clock::time_point start;
+    };
+
+    void on_push_back(std::size_t depth) {
+        auto seq = tail_seq_++;
+        if(seq % sample_period == 0 && sample_count_ != sample_slots) {
+            samples_[(sample_first_ + sample_count_++) % sample_slots] = sample{seq, clock::now()};
+        }
+        enqueued_.fetch_add(1, std::memory_order_relaxed);
+        update_depth(depth);
+    }
+
+    void on_push_front(std::size_t depth) {
+        --head_seq_;
+        enqueued_.fetch_add(1, std::memory_order_relaxed);
+        update_depth(depth);
+    }
+
+    void on_pop_front(std::size_t depth) {
+        auto seq = head_seq_++;
+        if(sample_count_ != 0 && samples_[sample_first_].seq == seq) {
+            queued_.record(clock::now() - samples_[sample_first_].when);
+            sample_first_ = (sample_first_ + 1) % sample_slots;
+            --sample_count_;
+        }
+        dequeued_.fetch_add(1, std::memory_order_relaxed);
+        depth_.store(depth, std::memory_order_relaxed);
+    }
+
+    /**
+     * @param depth - items added by the queue after the clear, items dropped by clear are not counted as dequeued
+     */
+    void on_clear(std::size_t depth) {
+        head_seq_ = tail_seq_;
+        tail_seq_ += depth;
+        sample_count_ = 0;
+        enqueued_.fetch_add(depth, std::memory_order_relaxed);
+        update_depth(depth);
+    }
+
+    wait_token wait_begin(bool will_block) {
+        wait_token ret;
+        if(will_block) {
+            ret.waiting = true;
+            ret.start = clock::now();
+        }
+        return ret;
+    }
+
+    void wait_end(const wait_token &token) {
+        if(token.waiting) {
+            blocked_.record(clock::now() - token.start);
+        }
+    }
+
+    queue_stats_snapshot snapshot() const {
+        queue_stats_snapshot ret;
+        ret.when = clock::now();
+        ret.depth = depth_.load(std::memory_order_relaxed);
+        ret.high_water = high_water_.load(std::memory_order_relaxed);
+        ret.enqueued = enqueued_.load(std::memory_order_relaxed);
+        ret.dequeued = dequeued_.load(std::memory_order_relaxed);
+        ret.queued = queued_.snapshot();
+        ret.blocked = blocked_.snapshot();
+        return ret;
+    }
+
+    /**
+     * Reset high water mark and histograms, counters keep running so rates stay monotonic
+     */
+    void reset() {
+        high_water_.store(depth_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        queued_.reset();
+        blocked_.reset();
+    }
+};
+
+} // namespace mks
+
+#endif // MKS_QUEUE_STATS_H
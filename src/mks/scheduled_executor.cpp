@@ -0,0 +1,136 @@
+#include "scheduled_executor.h"
+
+#include <thread>
+
+#include <mks/log.h>
+
+namespace mks {
+
+scheduled_executor::scheduled_executor(std::size_t workers, std::string name) {
+    MKS_ASSERT(workers > 0);
+    queue_.on_timer([this](dispatch_time_t time) {
+        // called under mtx_ from post/cancel or from timer thread
+        auto when = clock::now() + std::chrono::duration_cast<clock::duration>(time);
+        if(!has_deadline_ || when < deadline_) {
+            cond_.notify_one();
+        }
+        deadline_ = when;
+        has_deadline_ = true;
+    });
+    parts_.resize(workers);
+    workers_.reserve(workers);
+    for(std::size_t i = 0; i != workers; ++i) {
+        workers_.emplace_back(std::make_unique<worker>());
+        auto *w = workers_.back().get();
+        w->th = std::make_unique<mks::thread>(name + "-" + std::to_string(i), [this, w] { run_worker(w); });
+    }
+    timer_ = std::make_unique<mks::thread>(name + "-timer", [this] { run_timer(); });
+}
+
+scheduled_executor::~scheduled_executor() {
+    stop();
+}
+
+bool scheduled_executor::in_worker() const {
+    auto id = std::this_thread::get_id();
+    for(auto &w : workers_) {
+        if(w->th->get_id() == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void scheduled_executor::stop() {
+    if(in_worker()) {
+        MKS_LOG_E("scheduled_executor stop called from its task, worker can not join itself");
+        MKS_ASSERT(false);
+        return;
+    }
+    std::unique_lock<std::mutex> locker(mtx_);
+    if(!running_) {
+        return;
+    }
+    running_ = false;
+    locker.unlock();
+    cond_.notify_one();
+    timer_->join();
+
+    for(auto &w : workers_) {
+        w->queue.add(batch());
+    }
+    for(auto &w : workers_) {
+        w->th->join();
+    }
+
+    locker.lock();
+    queue_.clear([](dispatch_message<entry, clock> *) {});
+}
+
+dispatch_handle scheduled_executor::post(clock::time_point when, key_t key, task cb) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    if(!running_) {
+        return dispatch_handle{};
+    }
+    return queue_.post_at(entry{std::move(cb), key, when}, when);
+}
+
+bool scheduled_executor::cancel(const dispatch_handle &h) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    return queue_.remove(h);
+}
+
+std::size_t scheduled_executor::pending() const {
+    std::lock_guard<std::mutex> locker(mtx_);
+    return queue_.size();
+}
+
+void scheduled_executor::run_timer() {
+    batch due;
+    std::unique_lock<std::mutex> locker(mtx_);
+    while(running_) {
+        has_deadline_ = false;
+        queue_.get_all_due([&due](entry &&e) { due.push_back(std::move(e)); });
+        if(!due.empty()) {
+            locker.unlock();
+            distribute(due);
+            due.clear();
+            locker.lock();
+            continue;
+        }
+        if(has_deadline_) {
+            cond_.wait_until(locker, deadline_);
+        } else {
+            cond_.wait(locker);
+        }
+    }
+}
+
+void scheduled_executor::distribute(batch &due) {
+    for(auto &e : due) {
+        auto index = e.key != no_key ? e.key % workers_.size() : next_worker_++ % workers_.size();
+        parts_[index].push_back(std::move(e));
+    }
+    for(std::size_t i = 0; i != workers_.size(); ++i) {
+        if(!parts_[i].empty()) {
+            workers_[i]->queue.add(std::move(parts_[i]));
+            parts_[i] = batch();
+        }
+    }
+}
+
+void scheduled_executor::run_worker(worker *w) {
+    for(;;) {
+        auto tasks = w->queue.remove();
+        if(tasks.empty()) {
+            break;
+        }
+        for(auto &e : tasks) {
+            lateness_.record(clock::now() - e.when);
+            e.cb();
+            executed_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+} // namespace mks
@@ -0,0 +1,152 @@
+#ifndef MKS_SCHEDULED_EXECUTOR_H
+#define MKS_SCHEDULED_EXECUTOR_H
+
+/*
+ * Deadline driven executor
+ *
+ * timer thread owns dispatch_queue, sleeps until the next deadline and hands every due task to the workers
+ * in one batch per worker, slow task delays only tasks behind it on the same worker, not the timers
+ * tasks posted with key always run on the same worker so tasks of one key never run concurrently
+ * and run in deadline order, tasks without key are distributed round robin
+ *
+ * mks::scheduled_executor ex(4);
+ * auto h = ex.post_delayed(std::chrono::milliseconds(100), []{ ... });
+ * ex.post_delayed(session_id, std::chrono::seconds(30), [session_id]{ expire(session_id); });
+ * ex.cancel(h);
+ * auto late = ex.lateness().percentile(0.99);
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "dispatch_queue.h"
+#include "queue_buffer.h"
+#include "queue_stats.h"
+#include "thread.h"
+
+namespace mks {
+
+class scheduled_executor {
+public:
+    using task = std::function<void()>;
+    using clock = std::chrono::steady_clock;
+    using key_t = std::size_t;
+
+    /**
+     * Starts timer thread and workers
+     * @param workers - number of worker threads, at least one
+     */
+    explicit scheduled_executor(std::size_t workers, std::string name = "scheduled_executor");
+    ~scheduled_executor();
+
+    scheduled_executor(const scheduled_executor &) = delete;
+    scheduled_executor &operator=(const scheduled_executor &) = delete;
+
+    /**
+     * Thread safe, tasks pending at stop are dropped, running tasks are finished
+     * must not be called from a task (worker would join itself), also destructor must not run in a task
+     */
+    void stop();
+
+    /**
+     * Thread safe
+     */
+    template <class Rep, class Period>
+    dispatch_handle post_delayed(const std::chrono::duration<Rep, Period> &time, task cb) {
+        return post(clock::now() + std::chrono::duration_cast<clock::duration>(time), no_key, std::move(cb));
+    }
+
+    /**
+     * Thread safe, tasks with the same key are serialized
+     */
+    template <class Rep, class Period>
+    dispatch_handle post_delayed(key_t key, const std::chrono::duration<Rep, Period> &time, task cb) {
+        return post(clock::now() + std::chrono::duration_cast<clock::duration>(time), key, std::move(cb));
+    }
+
+    dispatch_handle post_at(clock::time_point when, task cb) {
+        return post(when, no_key, std::move(cb));
+    }
+
+    dispatch_handle post_at(key_t key, clock::time_point when, task cb) {
+        return post(when, key, std::move(cb));
+    }
+
+    /**
+     * Thread safe
+     * @return false when task was already handed to the worker or cancelled
+     */
+    bool cancel(const dispatch_handle &h);
+
+    /**
+     * Tasks waiting for their deadline
+     */
+    std::size_t pending() const;
+
+    std::size_t workers() const {
+        return workers_.size();
+    }
+
+    /**
+     * Time between task deadline and start of its execution
+     */
+    histogram_snapshot lateness() const {
+        return lateness_.snapshot();
+    }
+
+    std::uint64_t executed() const {
+        return executed_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr key_t no_key = std::numeric_limits<key_t>::max();
+
+    struct entry {
+        task cb;
+        key_t key = no_key;
+        clock::time_point when;
+    };
+
+    using batch = std::vector<entry>;
+
+    struct worker {
+        // empty batch stops the worker
+        queue_buffer<batch> queue;
+        // mks::thread is not moved after start, its state is shared with the running thread
+        std::unique_ptr<mks::thread> th;
+    };
+
+    dispatch_handle post(clock::time_point when, key_t key, task cb);
+    void run_timer();
+    void run_worker(worker *w);
+    bool in_worker() const;
+    void distribute(batch &due);
+
+    mutable std::mutex mtx_;
+    std::condition_variable cond_;
+    dispatch_queue<entry, dispatch_heap, clock> queue_;
+    // next deadline requested by queue_, valid when has_deadline_
+    clock::time_point deadline_;
+    bool has_deadline_ = false;
+    bool running_ = true;
+
+    std::vector<std::unique_ptr<worker>> workers_;
+    std::vector<batch> parts_;
+    std::size_t next_worker_ = 0;
+    std::unique_ptr<mks::thread> timer_;
+
+    latency_histogram lateness_;
+    std::atomic<std::uint64_t> executed_{0};
+};
+
+} // namespace mks
+
+#endif // MKS_SCHEDULED_EXECUTOR_H
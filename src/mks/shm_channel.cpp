@@ -0,0 +1,296 @@
+#include "shm_channel.h"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <linux/futex.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mks/log.h>
+
+namespace mks {
+
+static constexpr uint32_t shm_channel_magic = 0x6d6b7363; // "mksc"
+static constexpr uint32_t shm_channel_version = 1;
+
+/*
+ * Shared header placed at the beginning of the segment, producer and consumer
+ * owned fields are on separate cache lines
+ */
+struct shm_channel_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+
+    // written by producer
+    alignas(64) std::atomic<uint64_t> head;
+    std::atomic<uint32_t> data_seq;
+    std::atomic<uint32_t> producer_waiting;
+
+    // written by consumer
+    alignas(64) std::atomic<uint64_t> tail;
+    std::atomic<uint32_t> space_seq;
+    std::atomic<uint32_t> consumer_waiting;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory atomics must be lock free");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared memory atomics must be lock free");
+
+static constexpr std::size_t header_size = 4096;
+static_assert(sizeof(shm_channel_header) <= header_size, "header must fit into first page");
+
+static int futex_wait(std::atomic<uint32_t> *addr, uint32_t expected, std::chrono::milliseconds timeout) {
+    timespec ts{};
+    ts.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+    ts.tv_nsec = static_cast<long>((timeout.count() % 1000) * 1000000);
+    // not FUTEX_PRIVATE_FLAG, word is shared between processes
+    return static_cast<int>(::syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAIT, expected, &ts, nullptr, 0));
+}
+
+static void futex_wake(std::atomic<uint32_t> *addr) {
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+static std::size_t round_pow2(std::size_t v) {
+    std::size_t ret = 1;
+    while(ret < v) {
+        ret <<= 1;
+    }
+    return ret;
+}
+
+shm_channel::~shm_channel() {
+    close();
+}
+
+bool shm_channel::map(int fd, std::size_t size) {
+    auto *ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(ptr == MAP_FAILED) {
+        MKS_LOG_E("shm channel mmap failed errno={}", errno);
+        return false;
+    }
+    fd_ = fd;
+    mapped_size_ = size;
+    header_ = static_cast<shm_channel_header *>(ptr);
+    ring_ = static_cast<char *>(ptr) + header_size;
+    return true;
+}
+
+bool shm_channel::create(std::size_t capacity, const char *name) {
+    MKS_ASSERT(!valid());
+    capacity = round_pow2(capacity < 64 ? 64 : capacity);
+    auto fd = ::memfd_create(name, MFD_CLOEXEC);
+    if(fd < 0) {
+        MKS_LOG_E("memfd_create failed errno={}", errno);
+        return false;
+    }
+    auto size = header_size + capacity;
+    if(::ftruncate(fd, static_cast<off_t>(size)) < 0) {
+        MKS_LOG_E("shm channel ftruncate failed errno={}", errno);
+        ::close(fd);
+        return false;
+    }
+    if(!map(fd, size)) {
+        ::close(fd);
+        return false;
+    }
+    // fresh memfd is zero filled, atomics are valid from the start
+    header_->capacity = capacity;
+    header_->version = shm_channel_version;
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = shm_channel_magic;
+    mask_ = capacity - 1;
+    return true;
+}
+
+bool shm_channel::attach(int fd) {
+    MKS_ASSERT(!valid());
+    struct stat st{};
+    if(::fstat(fd, &st) < 0 || static_cast<std::size_t>(st.st_size) <= header_size) {
+        MKS_LOG_E("shm channel attach invalid fd={}", fd);
+        return false;
+    }
+    if(!map(fd, static_cast<std::size_t>(st.st_size))) {
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    auto capacity = header_->capacity;
+    // ring position is masked, capacity must be non zero power of two
+    if(header_->magic != shm_channel_magic || header_->version != shm_channel_version ||
+       capacity == 0 || (capacity & (capacity - 1)) != 0 || capacity + header_size != mapped_size_) {
+        MKS_LOG_E("shm channel attach header mismatch");
+        ::munmap(header_, mapped_size_);
+        header_ = nullptr;
+        ring_ = nullptr;
+        fd_ = -1;
+        return false;
+    }
+    mask_ = capacity - 1;
+    return true;
+}
+
+void shm_channel::close() {
+    if(header_ != nullptr) {
+        ::munmap(header_, mapped_size_);
+        header_ = nullptr;
+        ring_ = nullptr;
+    }
+    if(fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    mapped_size_ = 0;
+    mask_ = 0;
+    broken_ = false;
+}
+
+void shm_channel::copy_in(uint64_t pos, const void *data, std::size_t len) {
+    auto offset = pos & mask_;
+    auto first = std::min(len, capacity() - offset);
+    ::memcpy(ring_ + offset, data, first);
+    ::memcpy(ring_, static_cast<const char *>(data) + first, len - first);
+}
+
+void shm_channel::copy_out(uint64_t pos, void *data, std::size_t len) const {
+    auto offset = pos & mask_;
+    auto first = std::min(len, capacity() - offset);
+    ::memcpy(data, ring_ + offset, first);
+    ::memcpy(static_cast<char *>(data) + first, ring_, len - first);
+}
+
+std::size_t shm_channel::used() const {
+    MKS_ASSERT(valid());
+    auto head = header_->head.load(std::memory_order_acquire);
+    auto tail = header_->tail.load(std::memory_order_acquire);
+    return static_cast<std::size_t>(head - tail);
+}
+
+bool shm_channel::write(const void *data, std::size_t len) {
+    MKS_ASSERT(valid());
+    auto need = frame_header_size + len;
+    if(need > capacity() || len > static_cast<std::size_t>(INT32_MAX)) {
+        return false;
+    }
+    if(broken_) {
+        return false;
+    }
+    auto head = header_->head.load(std::memory_order_relaxed);
+    auto tail = header_->tail.load(std::memory_order_acquire);
+    if(static_cast<std::size_t>(head - tail) > capacity()) {
+        MKS_LOG_E("shm channel corrupted head={} tail={}", head, tail);
+        broken_ = true;
+        return false;
+    }
+    if(capacity() - static_cast<std::size_t>(head - tail) < need) {
+        return false;
+    }
+    int32_t be32 = htonl(static_cast<int32_t>(len));
+    copy_in(head, &be32, sizeof(be32));
+    copy_in(head + frame_header_size, data, len);
+    header_->head.store(head + need, std::memory_order_release);
+
+    // pairs with fence in wait_readable, either consumer sees new head or we see it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(header_->consumer_waiting.load(std::memory_order_relaxed) != 0) {
+        header_->data_seq.fetch_add(1, std::memory_order_release);
+        futex_wake(&header_->data_seq);
+    }
+    return true;
+}
+
+bool shm_channel::read(Buffer &out) {
+    MKS_ASSERT(valid());
+    if(broken_) {
+        return false;
+    }
+    auto tail = header_->tail.load(std::memory_order_relaxed);
+    auto head = header_->head.load(std::memory_order_acquire);
+    if(head == tail) {
+        return false;
+    }
+    // head and length prefix are written by the peer process, never trusted
+    auto published = static_cast<std::size_t>(head - tail);
+    if(published < frame_header_size || published > capacity()) {
+        MKS_LOG_E("shm channel corrupted head={} tail={}", head, tail);
+        broken_ = true;
+        return false;
+    }
+    uint32_t be32 = 0;
+    copy_out(tail, &be32, sizeof(be32));
+    auto len = static_cast<std::size_t>(ntohl(be32));
+    if(len > published - frame_header_size) {
+        MKS_LOG_E("shm channel corrupted record len={} published={}", len, published);
+        broken_ = true;
+        return false;
+    }
+    out.EnsureWritableBytes(len);
+    copy_out(tail + frame_header_size, out.WriteBegin(), len);
+    out.WriteBytes(len);
+    header_->tail.store(tail + frame_header_size + len, std::memory_order_release);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(header_->producer_waiting.load(std::memory_order_relaxed) != 0) {
+        header_->space_seq.fetch_add(1, std::memory_order_release);
+        futex_wake(&header_->space_seq);
+    }
+    return true;
+}
+
+bool shm_channel::wait_readable(std::chrono::milliseconds timeout) {
+    MKS_ASSERT(valid());
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    for(;;) {
+        auto seq = header_->data_seq.load(std::memory_order_acquire);
+        header_->consumer_waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!empty()) {
+            header_->consumer_waiting.store(0, std::memory_order_relaxed);
+            return true;
+        }
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if(left.count() <= 0) {
+            header_->consumer_waiting.store(0, std::memory_order_relaxed);
+            return false;
+        }
+        futex_wait(&header_->data_seq, seq, left);
+        header_->consumer_waiting.store(0, std::memory_order_relaxed);
+    }
+}
+
+bool shm_channel::wait_writable(std::size_t len, std::chrono::milliseconds timeout) {
+    MKS_ASSERT(valid());
+    auto need = frame_header_size + len;
+    if(need > capacity()) {
+        return false;
+    }
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    for(;;) {
+        auto seq = header_->space_seq.load(std::memory_order_acquire);
+        header_->producer_waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(capacity() - used() >= need) {
+            header_->producer_waiting.store(0, std::memory_order_relaxed);
+            return true;
+        }
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if(left.count() <= 0) {
+            header_->producer_waiting.store(0, std::memory_order_relaxed);
+            return false;
+        }
+        futex_wait(&header_->space_seq, seq, left);
+        header_->producer_waiting.store(0, std::memory_order_relaxed);
+    }
+}
+
+} // namespace mks
+
+#endif // __linux__
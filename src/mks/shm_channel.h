@@ -0,0 +1,126 @@
+#ifndef MKS_SHM_CHANNEL_H
+#define MKS_SHM_CHANNEL_H
+
+/*
+ * Cross process single producer / single consumer channel (Linux only)
+ *
+ * byte ring lives in memfd shared memory, records are framed the same way as mks::Buffer
+ * AppendInt32/ReadInt32 framing: 4 byte network endian length followed by payload
+ * waiting side sleeps on futex placed in the shared header, other side wakes it only when it is waiting
+ *
+ * process A:                                 process B:
+ *      mks::shm_channel ch;                       mks::shm_channel ch;
+ *      ch.create(1 << 20);                        ch.attach(fd); // received by SCM_RIGHTS or inherited
+ *      send_fd(sock, ch.fd());                    mks::Buffer buf;
+ *      ch.write(buf);                             if(ch.wait_readable(timeout)) ch.read(buf);
+ */
+
+#ifdef __linux__
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "buffer.h"
+
+namespace mks {
+
+struct shm_channel_header;
+
+class shm_channel {
+    int fd_ = -1;
+    shm_channel_header *header_ = nullptr;
+    char *ring_ = nullptr;
+    std::size_t mapped_size_ = 0;
+    std::size_t mask_ = 0;
+    // peer wrote inconsistent positions or record length
+    bool broken_ = false;
+
+    bool map(int fd, std::size_t size);
+    void copy_in(uint64_t pos, const void *data, std::size_t len);
+    void copy_out(uint64_t pos, void *data, std::size_t len) const;
+
+public:
+    // length prefix of every record
+    static constexpr std::size_t frame_header_size = sizeof(int32_t);
+
+    shm_channel() = default;
+    ~shm_channel();
+
+    shm_channel(const shm_channel &) = delete;
+    shm_channel &operator=(const shm_channel &) = delete;
+
+    /**
+     * Create new shared segment
+     * @param capacity - ring size in bytes, rounded up to power of two
+     */
+    bool create(std::size_t capacity, const char *name = "mks_shm_channel");
+
+    /**
+     * Map segment created by other process, channel takes ownership of fd
+     */
+    bool attach(int fd);
+
+    void close();
+
+    int fd() const {
+        return fd_;
+    }
+
+    bool valid() const {
+        return header_ != nullptr;
+    }
+
+    /**
+     * Peer corrupted the shared ring, read() and write() fail until close()
+     */
+    bool broken() const {
+        return broken_;
+    }
+
+    std::size_t capacity() const {
+        return mask_ + 1;
+    }
+
+    /**
+     * Producer side, record is written only as whole
+     * @return false when there is not enough space or channel is broken
+     */
+    bool write(const void *data, std::size_t len);
+
+    bool write(const Buffer &buf) {
+        return write(buf.data(), buf.length());
+    }
+
+    /**
+     * Producer side, block until record of len bytes fits or timeout expires
+     */
+    bool wait_writable(std::size_t len, std::chrono::milliseconds timeout);
+
+    /**
+     * Consumer side, payload of the next record is appended to out
+     * @return false when channel is empty or broken
+     */
+    bool read(Buffer &out);
+
+    /**
+     * Consumer side, block until at least one record is available or timeout expires
+     */
+    bool wait_readable(std::chrono::milliseconds timeout);
+
+    /**
+     * Bytes written and not yet consumed (including frame headers)
+     */
+    std::size_t used() const;
+
+    bool empty() const {
+        return used() == 0;
+    }
+};
+
+} // namespace mks
+
+#endif // __linux__
+
+#endif // MKS_SHM_CHANNEL_H
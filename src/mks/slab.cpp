@@ -0,0 +1,93 @@
+#include "slab.h"
+
+#include <algorithm>
+
+#include <mks/log.h>
+
+namespace mks {
+
+namespace {
+
+std::size_t round_up(std::size_t value, std::size_t align) {
+    return (value + align - 1) / align * align;
+}
+
+} // namespace
+
+slab::slab(std::size_t size, std::size_t align, std::size_t chunk_size, std::pmr::memory_resource *upstream)
+    : upstream_(upstream) {
+    MKS_ASSERT(align != 0 && (align & (align - 1)) == 0);
+    align = std::max(align, alignof(free_block));
+    block_size_ = round_up(std::max(size, sizeof(free_block)), align);
+    first_block_ = round_up(sizeof(chunk_header), align);
+    chunk_size_ = 1;
+    while(chunk_size_ < chunk_size || chunk_size_ < first_block_ + 8 * block_size_) {
+        chunk_size_ <<= 1;
+    }
+    blocks_per_chunk_ = (chunk_size_ - first_block_) / block_size_;
+}
+
+slab::~slab() {
+    for(auto *c : chunks_) {
+        free_chunk(c);
+    }
+}
+
+void slab::grow() {
+    void *p;
+    if(upstream_ != nullptr) {
+        p = upstream_->allocate(chunk_size_, chunk_size_);
+    } else {
+        p = ::operator new(chunk_size_, std::align_val_t(chunk_size_));
+    }
+    auto *c = new(p) chunk_header{0};
+    chunks_.push_back(c);
+    bump_ = reinterpret_cast<char *>(c) + first_block_;
+    bump_end_ = bump_ + blocks_per_chunk_ * block_size_;
+}
+
+void slab::free_chunk(chunk_header *c) {
+    if(upstream_ != nullptr) {
+        upstream_->deallocate(c, chunk_size_, chunk_size_);
+    } else {
+        ::operator delete(c, std::align_val_t(chunk_size_));
+    }
+}
+
+void slab::reserve(std::size_t n) {
+    while(capacity() - live_ < n) {
+        // keep unused tail of the current chunk, lowest block first
+        while(bump_end_ != bump_) {
+            bump_end_ -= block_size_;
+            free_ = new(bump_end_) free_block{free_};
+        }
+        grow();
+    }
+}
+
+std::size_t slab::trim() {
+    auto unused = [](chunk_header *c) { return c->live == 0; };
+    if(std::none_of(chunks_.begin(), chunks_.end(), unused)) {
+        return 0;
+    }
+    for(auto **link = &free_; *link != nullptr;) {
+        if(chunk_of(*link)->live == 0) {
+            *link = (*link)->next;
+        } else {
+            link = &(*link)->next;
+        }
+    }
+    // bump_end_ can be the first byte behind its chunk
+    if(bump_ != nullptr && chunk_of(bump_end_ - 1)->live == 0) {
+        bump_ = bump_end_ = nullptr;
+    }
+    auto it = std::stable_partition(chunks_.begin(), chunks_.end(), [&unused](chunk_header *c) { return !unused(c); });
+    auto released = static_cast<std::size_t>(chunks_.end() - it);
+    for(auto c = it; c != chunks_.end(); ++c) {
+        free_chunk(*c);
+    }
+    chunks_.erase(it, chunks_.end());
+    return released;
+}
+
+} // namespace mks
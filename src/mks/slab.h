@@ -0,0 +1,135 @@
+#ifndef MKS_SLAB_H
+#define MKS_SLAB_H
+
+/*
+ * Untyped slab of fixed size blocks, not thread safe
+ *
+ * blocks are carved from chunks aligned to their own (power of two) size, so the chunk of a block
+ * is found by masking its address, fresh chunk is handed out sequentially so consecutive allocations
+ * are adjacent, freed blocks form intrusive LIFO list and are reused first
+ * memory is returned to the system only by trim() (chunks without live blocks) or destructor
+ *
+ * mks::slab s(sizeof(message), alignof(message));
+ * auto *m = new(s.allocate()) message(...);
+ * m->~message();
+ * s.deallocate(m);
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <vector>
+
+namespace mks {
+
+class slab {
+public:
+    static constexpr std::size_t default_chunk_size = 64 * 1024;
+
+    /**
+     * @param size - bytes of one block, at least one pointer is used
+     * @param align - alignment of blocks, power of two
+     * @param chunk_size - bytes requested from the system at once, rounded up to power of two fitting at least 8 blocks
+     * @param upstream - source of chunks (aligned to chunk size), nullptr for global operator new
+     */
+    slab(std::size_t size, std::size_t align, std::size_t chunk_size = default_chunk_size,
+         std::pmr::memory_resource *upstream = nullptr);
+    ~slab();
+
+    slab(const slab &) = delete;
+    slab &operator=(const slab &) = delete;
+
+    void *allocate() {
+        void *ret;
+        if(free_ != nullptr) {
+            ret = free_;
+            free_ = free_->next;
+        } else {
+            if(bump_ == bump_end_) {
+                grow();
+            }
+            ret = bump_;
+            bump_ += block_size_;
+        }
+        ++chunk_of(ret)->live;
+        ++live_;
+        return ret;
+    }
+
+    /**
+     * @param p - block returned by allocate() of this slab
+     */
+    void deallocate(void *p) {
+        --chunk_of(p)->live;
+        --live_;
+        free_ = new(p) free_block{free_};
+    }
+
+    /**
+     * Makes sure next n allocations do not ask the system for memory
+     */
+    void reserve(std::size_t n);
+
+    /**
+     * Returns chunks without live blocks to the system
+     * @return number of released chunks
+     */
+    std::size_t trim();
+
+    std::size_t block_size() const {
+        return block_size_;
+    }
+
+    std::size_t chunk_size() const {
+        return chunk_size_;
+    }
+
+    /**
+     * Blocks of all chunks
+     */
+    std::size_t capacity() const {
+        return chunks_.size() * blocks_per_chunk_;
+    }
+
+    /**
+     * Allocated blocks
+     */
+    std::size_t live() const {
+        return live_;
+    }
+
+private:
+    struct chunk_header {
+        std::size_t live;
+    };
+
+    struct free_block {
+        free_block *next;
+    };
+
+    chunk_header *chunk_of(void *p) const {
+        return reinterpret_cast<chunk_header *>(reinterpret_cast<std::uintptr_t>(p) & ~(chunk_size_ - 1));
+    }
+
+    void grow();
+    void free_chunk(chunk_header *c);
+
+    std::size_t block_size_;
+    std::size_t chunk_size_;
+    // offset of the first block behind chunk_header
+    std::size_t first_block_;
+    std::size_t blocks_per_chunk_;
+    std::pmr::memory_resource *upstream_;
+
+    free_block *free_ = nullptr;
+    // unused tail of the newest chunk
+    char *bump_ = nullptr;
+    char *bump_end_ = nullptr;
+    std::size_t live_ = 0;
+    std::vector<chunk_header *> chunks_;
+};
+
+} // namespace mks
+
+#endif // MKS_SLAB_H
@@ -0,0 +1,19 @@
+#ifndef MKS_TEST_CHECK_H
+#define MKS_TEST_CHECK_H
+
+/*
+ * Minimal check for the tests, unlike assert stays enabled in release builds
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if(!(cond)) {                                                                                                  \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);                            \
+            std::exit(1);                                                                                              \
+        }                                                                                                              \
+    } while(0)
+
+#endif // MKS_TEST_CHECK_H
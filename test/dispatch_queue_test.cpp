@@ -0,0 +1,106 @@
+#include <mks/dispatch_clock.h>
+#include <mks/dispatch_heap.h>
+#include <mks/dispatch_queue.h>
+
+#include <stdexcept>
+#include <thread>
+
+#include "check.h"
+
+/**
+ * Callback reposts message which is due at once, each get_all_due() dispatches only the message due at its start
+ * @param delay - of the reposts, negative is due for every backend, zero is due within the tick of coarse clock
+ */
+template <typename Backend, typename Clock = dispatch_clock>
+void repost_from_get_all_due(std::chrono::milliseconds delay) {
+    dispatch_queue<int, Backend, Clock> queue;
+    int arms = 0;
+    queue.on_timer([&](dispatch_time_t) { ++arms; });
+    queue.post_delayed(0, delay);
+
+    int dispatched = 0;
+    auto repost = [&](int &&val) {
+        ++dispatched;
+        if(val < 50) {
+            queue.post_delayed(val + 1, delay);
+        }
+    };
+    for(int calls = 0; !queue.empty(); ++calls) {
+        CHECK(calls < 100000);
+        arms = 0;
+        auto count = queue.get_all_due(repost);
+        CHECK(count <= 1);
+        if(delay.count() < 0) {
+            CHECK(count == 1);
+            // repost re-arms the timer once, after the batch
+            CHECK(arms == (queue.empty() ? 0 : 1));
+        }
+    }
+    CHECK(dispatched == 51);
+}
+
+template <typename Backend>
+void messages_due_before_batch() {
+    dispatch_queue<int, Backend> queue;
+    queue.on_timer([](dispatch_time_t) {});
+    for(int i = 0; i != 10; ++i) {
+        queue.post_delayed(i, std::chrono::milliseconds(-1));
+    }
+    int dispatched = 0;
+    auto count = queue.get_all_due([&](int &&) {
+        ++dispatched;
+        queue.post_delayed(-1, std::chrono::milliseconds(0));
+    });
+    CHECK(count == 10);
+    CHECK(dispatched == 10);
+    CHECK(queue.size() == 10);
+    queue.clear([](dispatch_message<int> *) {});
+}
+
+/**
+ * Periodic callback throwing from get() drops the message, handle becomes stale and queue stays usable
+ */
+template <typename Backend>
+void periodic_throws_from_get() {
+    dispatch_queue<int, Backend> queue;
+    int arms = 0;
+    queue.on_timer([&](dispatch_time_t) { ++arms; });
+    auto periodic = queue.post_periodic(1, std::chrono::milliseconds(1));
+    queue.post_delayed(2, std::chrono::seconds(100));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    arms = 0;
+    bool thrown = false;
+    try {
+        queue.get([](const int &) { throw std::runtime_error("periodic"); });
+    } catch(const std::runtime_error &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(arms == 1);
+    CHECK(queue.size() == 1);
+    CHECK(!queue.remove(periodic));
+
+    // message went back to the pool and is reused
+    queue.post_delayed(3, std::chrono::milliseconds(-1));
+    int val = 0;
+    CHECK(queue.get([&](int &&v) { val = v; }));
+    CHECK(val == 3);
+    queue.clear([](dispatch_message<int> *) {});
+}
+
+int main() {
+    using std::chrono::milliseconds;
+    repost_from_get_all_due<dispatch_list>(milliseconds(-1));
+    repost_from_get_all_due<dispatch_heap>(milliseconds(-1));
+    repost_from_get_all_due<dispatch_wheel<>>(milliseconds(-1));
+    repost_from_get_all_due<dispatch_list, dispatch_coarse_clock>(milliseconds(0));
+    repost_from_get_all_due<dispatch_heap, dispatch_coarse_clock>(milliseconds(0));
+    messages_due_before_batch<dispatch_list>();
+    messages_due_before_batch<dispatch_heap>();
+    messages_due_before_batch<dispatch_wheel<>>();
+    periodic_throws_from_get<dispatch_list>();
+    periodic_throws_from_get<dispatch_heap>();
+    periodic_throws_from_get<dispatch_wheel<>>();
+    return 0;
+}